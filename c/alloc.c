@@ -0,0 +1,260 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "alloc.h"
+#include "logging.h"
+
+// Allocations made by this thread so far.
+static __thread uint64_t nallocs = 0;
+
+#ifdef ALLOC_PROFILE
+
+// Call sites, found by hashing func and line. Entries are filled in under
+// site_lock and published by setting func last, so lookups need no lock.
+// A program has a few dozen call sites at most: if there are more than
+// fit, the rest are all counted against OTHER_SITE, a slot of its own that
+// no real call site hashes to.
+#define MAX_SITES 256
+#define HASHED_SITES (MAX_SITES - 1)
+#define OTHER_SITE (MAX_SITES - 1)
+
+static alloc_site_t sites[MAX_SITES];
+static pthread_mutex_t site_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Every profiled block starts with one of these, so that alloc_free() and
+// alloc_realloc() know how big it is and where it came from. The union
+// keeps the block itself as aligned as malloc() would have.
+#define HEADER_MAGIC 0xa110c8ed
+
+typedef union {
+    struct {
+        uint32_t magic;
+        uint32_t site;
+        size_t size;
+    } h;
+    long double align;
+} header_t;
+
+static uint32_t find_site(const char *func, const char *file, int line) {
+    uint32_t start = (((uintptr_t) func >> 3) * 31 + line) * 0x9e3779b1u % HASHED_SITES;
+    uint32_t i = start;
+    do {
+        const char *f = __atomic_load_n(&sites[i].func, __ATOMIC_ACQUIRE);
+        if (f == NULL) {
+            break;
+        }
+        if (f == func && sites[i].line == line) {
+            return i;
+        }
+        i = (i + 1) % HASHED_SITES;
+    } while (i != start);
+
+    // Not there: add it (unless another thread just did). If every slot
+    // is taken by other sites, count it as OTHER_SITE.
+    pthread_mutex_lock(&site_lock);
+    i = start;
+    do {
+        if (sites[i].func == NULL) {
+            sites[i].file = file;
+            sites[i].line = line;
+            __atomic_store_n(&sites[i].func, func, __ATOMIC_RELEASE);
+            break;
+        }
+        if (sites[i].func == func && sites[i].line == line) {
+            break;
+        }
+        i = (i + 1) % HASHED_SITES;
+    } while (i != start);
+    if (sites[i].func != func || sites[i].line != line) {
+        i = OTHER_SITE;
+        if (sites[i].func == NULL) {
+            sites[i].file = "-";
+            __atomic_store_n(&sites[i].func, "(other)", __ATOMIC_RELEASE);
+        }
+    }
+    pthread_mutex_unlock(&site_lock);
+    return i;
+}
+
+static void site_alloc(uint32_t site, size_t size) {
+    alloc_site_t *s = &sites[site];
+    __atomic_fetch_add(&s->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s->bytes, size, __ATOMIC_RELAXED);
+    uint64_t live = __atomic_add_fetch(&s->live, size, __ATOMIC_RELAXED);
+    uint64_t peak = __atomic_load_n(&s->peak, __ATOMIC_RELAXED);
+    while (live > peak &&
+           !__atomic_compare_exchange_n(&s->peak, &peak, live, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+static void site_free(uint32_t site, size_t size) {
+    __atomic_fetch_sub(&sites[site].live, size, __ATOMIC_RELAXED);
+}
+
+/* Return the header of a block from alloc_malloc() etc. */
+static header_t *block_header(void *ptr) {
+    header_t *header = (header_t *) ptr - 1;
+    assert(header->h.magic == HEADER_MAGIC);  // not from alloc_malloc()?
+    return header;
+}
+
+static void *finish_alloc(header_t *header, uint32_t site, size_t size) {
+    if (header == NULL) {
+        return NULL;
+    }
+    nallocs++;
+    header->h.magic = HEADER_MAGIC;
+    header->h.site = site;
+    header->h.size = size;
+    site_alloc(site, size);
+    return header + 1;
+}
+
+void *alloc_malloc_at(const char *func, const char *file, int line, size_t size) {
+    uint32_t site = find_site(func, file, line);
+    return finish_alloc(malloc(sizeof(header_t) + size), site, size);
+}
+
+void *alloc_calloc_at(const char *func, const char *file, int line, size_t nmemb, size_t size) {
+    if (size != 0 && nmemb > (SIZE_MAX - sizeof(header_t)) / size) {
+        return NULL;
+    }
+    uint32_t site = find_site(func, file, line);
+    size *= nmemb;
+    return finish_alloc(calloc(1, sizeof(header_t) + size), site, size);
+}
+
+/* A realloc() counts as freeing the old block (at the site that allocated
+ * it) and allocating the new one (at this site).
+ */
+void *alloc_realloc_at(const char *func, const char *file, int line, void *ptr, size_t size) {
+    if (ptr == NULL) {
+        return alloc_malloc_at(func, file, line, size);
+    }
+    uint32_t site = find_site(func, file, line);
+    header_t *old = block_header(ptr);
+    uint32_t old_site = old->h.site;
+    size_t old_size = old->h.size;
+    header_t *header = realloc(old, sizeof(header_t) + size);
+    if (header == NULL) {
+        return NULL;
+    }
+    site_free(old_site, old_size);
+    return finish_alloc(header, site, size);
+}
+
+void *(alloc_malloc)(size_t size) {
+    return alloc_malloc_at("?", __FILE__, 0, size);
+}
+
+void *(alloc_calloc)(size_t nmemb, size_t size) {
+    return alloc_calloc_at("?", __FILE__, 0, nmemb, size);
+}
+
+void *(alloc_realloc)(void *ptr, size_t size) {
+    return alloc_realloc_at("?", __FILE__, 0, ptr, size);
+}
+
+void alloc_free(void *ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+    header_t *header = block_header(ptr);
+    site_free(header->h.site, header->h.size);
+    header->h.magic = 0;
+    free(header);
+}
+
+/* Copy (a snapshot of) up to max call sites to sites, and return how many
+ * there are in all.
+ */
+int alloc_profile_sites(alloc_site_t out[], int max) {
+    int n = 0;
+    for (int i = 0; i < MAX_SITES; i++) {
+        if (__atomic_load_n(&sites[i].func, __ATOMIC_ACQUIRE) == NULL) {
+            continue;
+        }
+        if (n < max) {
+            alloc_site_t *s = &out[n];
+            *s = sites[i];
+            s->count = __atomic_load_n(&sites[i].count, __ATOMIC_RELAXED);
+            s->bytes = __atomic_load_n(&sites[i].bytes, __ATOMIC_RELAXED);
+            s->live = __atomic_load_n(&sites[i].live, __ATOMIC_RELAXED);
+            s->peak = __atomic_load_n(&sites[i].peak, __ATOMIC_RELAXED);
+        }
+        n++;
+    }
+    return n;
+}
+
+static int compare_bytes(const void *a, const void *b) {
+    uint64_t bytes_a = ((alloc_site_t *) a)->bytes;
+    uint64_t bytes_b = ((alloc_site_t *) b)->bytes;
+    return (bytes_a < bytes_b) - (bytes_a > bytes_b);
+}
+
+/* Log the allocations of every call site so far, most bytes first. */
+void alloc_profile_report(void) {
+    alloc_site_t snapshot[MAX_SITES];
+    int n = alloc_profile_sites(snapshot, MAX_SITES);
+    qsort(snapshot, n, sizeof(alloc_site_t), compare_bytes);
+
+    uint64_t count = 0, bytes = 0, live = 0;
+    for (int i = 0; i < n; i++) {
+        count += snapshot[i].count;
+        bytes += snapshot[i].bytes;
+        live += snapshot[i].live;
+    }
+    log_info("alloc profile: %lu allocations, %lu bytes, %lu bytes live, %d call sites",
+             (unsigned long) count,
+             (unsigned long) bytes,
+             (unsigned long) live,
+             n);
+    for (int i = 0; i < n; i++) {
+        alloc_site_t *s = &snapshot[i];
+        log_info("  %10lu allocs %12lu bytes %10lu live %10lu peak  %s (%s:%d)",
+                 (unsigned long) s->count,
+                 (unsigned long) s->bytes,
+                 (unsigned long) s->live,
+                 (unsigned long) s->peak,
+                 s->func,
+                 s->file,
+                 s->line);
+    }
+}
+
+#else
+
+void *alloc_malloc(size_t size) {
+    nallocs++;
+    return malloc(size);
+}
+
+void *alloc_calloc(size_t nmemb, size_t size) {
+    nallocs++;
+    return calloc(nmemb, size);
+}
+
+void *alloc_realloc(void *ptr, size_t size) {
+    nallocs++;
+    return realloc(ptr, size);
+}
+
+void alloc_free(void *ptr) {
+    free(ptr);
+}
+
+int alloc_profile_sites(alloc_site_t sites[], int max) {
+    return 0;
+}
+
+void alloc_profile_report(void) {
+}
+
+#endif
+
+uint64_t alloc_count(void) {
+    return nallocs;
+}
@@ -0,0 +1,58 @@
+#ifndef _ALLOC_H
+#define _ALLOC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The simulator allocates its data structures (hands, decks, peg states,
+// stringbuilders, caches, tables, async log rings) through these wrappers,
+// which behave exactly like malloc(), calloc(), realloc() and free() but
+// also count: a test can check that a piece of code does not allocate by
+// comparing alloc_count() before and after. Counters are per thread, so
+// they cost no more than an increment and are not disturbed by other
+// threads.
+//
+// Memory from alloc_malloc() etc. must be released with alloc_free() (or
+// the owning type's free function), never plain free().
+void *alloc_malloc(size_t size);
+void *alloc_calloc(size_t nmemb, size_t size);
+void *alloc_realloc(void *ptr, size_t size);
+void alloc_free(void *ptr);
+uint64_t alloc_count(void);
+
+// Allocation profiling: build with -DALLOC_PROFILE (make ALLOC_PROFILE=1)
+// and every allocation is attributed to the function (and line) that
+// called alloc_malloc() etc., e.g. new_hand() or sb_fit_buffer(). Each such
+// call site counts allocations, bytes allocated, and live bytes (current
+// and peak), over all threads. alloc_profile_report() logs them, at any
+// time; cribsim does so at exit. Without ALLOC_PROFILE there is nothing
+// to report.
+typedef struct {
+    const char *func;
+    const char *file;
+    int line;
+    uint64_t count;                     // allocations (including reallocs)
+    uint64_t bytes;                     // bytes allocated, in total
+    uint64_t live;                      // bytes allocated and not yet freed
+    uint64_t peak;                      // the most live bytes at any time
+} alloc_site_t;
+
+int alloc_profile_sites(alloc_site_t sites[], int max);
+void alloc_profile_report(void);
+
+#ifdef ALLOC_PROFILE
+
+void *alloc_malloc_at(const char *func, const char *file, int line, size_t size);
+void *alloc_calloc_at(const char *func, const char *file, int line, size_t nmemb, size_t size);
+void *alloc_realloc_at(const char *func, const char *file, int line, void *ptr, size_t size);
+
+#define alloc_malloc(size) \
+    alloc_malloc_at(__func__, __FILE__, __LINE__, size)
+#define alloc_calloc(nmemb, size) \
+    alloc_calloc_at(__func__, __FILE__, __LINE__, nmemb, size)
+#define alloc_realloc(ptr, size) \
+    alloc_realloc_at(__func__, __FILE__, __LINE__, ptr, size)
+
+#endif
+
+#endif
@@ -0,0 +1,540 @@
+#define _POSIX_C_SOURCE 200809L    // for nanosleep(), localtime_r(), flockfile()
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "alloc.h"
+#include "async_log.h"
+#include "logging.h"
+
+// A format is split into pieces that each end with (at most) one
+// conversion, so that the writer can print a record piece by piece with
+// the argument type it expects.
+typedef enum {
+    ARG_NONE,                   // trailing text, no conversion
+    ARG_INT,
+    ARG_LONG,
+    ARG_LLONG,
+    ARG_SIZE,
+    ARG_DOUBLE,
+    ARG_STRING,
+    ARG_POINTER,
+} arg_type_t;
+
+typedef struct {
+    char *fmt;
+    arg_type_t type;
+} piece_t;
+
+// One log statement: records refer to it by its id (slot in formats[] + 1).
+typedef struct {
+    const char *fmt;            // the key: all four fields
+    const char *file;
+    int line;
+    int level;
+    bool sync;                  // cannot be logged asynchronously
+    int npieces;
+    piece_t pieces[];
+} format_t;
+
+#define MAX_FORMATS 4096        // power of 2
+
+static format_t *formats[MAX_FORMATS];
+
+// A record is a header word followed by one word per argument; a string
+// argument is its length, followed by its bytes (with a NUL, padded to a
+// whole word).
+typedef struct {
+    uint16_t id;                // 0: padding up to the end of the ring
+    uint16_t nwords;            // including the header
+    int32_t game;
+} record_header_t;
+
+#define MAX_RECORD_WORDS 64
+
+// Single-producer, single-consumer ring of words. head and tail only ever
+// grow; they live on separate cache lines, since they are written by
+// different threads.
+typedef struct {
+    uint64_t head;              // written by the owning thread
+    char pad1[56];
+    uint64_t tail;              // written by the writer thread
+    char pad2[56];
+    uint64_t waits;             // times the owner found the ring full
+    int worker;
+    uint64_t nwords;            // power of 2
+    uint64_t words[];
+} ring_t;
+
+bool logging_async = false;
+
+static FILE *output;
+static uint64_t ring_words;
+static ring_t *rings[ASYNC_LOG_MAX_THREADS];
+static int nrings;
+static pthread_t writer;
+static bool stopping;
+
+// Bumped by every async_log_start(): a thread's my_ring is only good for
+// the run it was made in, since async_log_stop() frees every ring.
+static unsigned generation = 0;
+
+static __thread ring_t *my_ring = NULL;
+static __thread unsigned my_generation = 0;
+static __thread int my_worker = ASYNC_LOG_NO_WORKER;
+static __thread int my_game = -1;
+
+static void pause_ns(long ns) {
+    struct timespec ts = {tv_sec: 0, tv_nsec: ns};
+    nanosleep(&ts, NULL);
+}
+
+/* Copy the len bytes at start into a new string (like strndup(), but
+ * through alloc_malloc(), so that allocation profiles see it).
+ */
+static char *copy_piece(const char *start, size_t len) {
+    char *piece = alloc_malloc(len + 1);
+    if (piece != NULL) {
+        memcpy(piece, start, len);
+        piece[len] = '\0';
+    }
+    return piece;
+}
+
+static void free_format(format_t *format) {
+    for (int i = 0; i < format->npieces; i++) {
+        alloc_free(format->pieces[i].fmt);
+    }
+    alloc_free(format);
+}
+
+/* Split fmt into pieces. If it uses a conversion we do not handle, the
+ * format is marked sync. Returns NULL if out of memory.
+ */
+static format_t *parse_format(int level, const char *file, int line, const char *fmt) {
+    int maxpieces = 1;
+    for (const char *p = fmt; *p; p++) {
+        maxpieces += (*p == '%');
+    }
+    format_t *format = alloc_calloc(1, sizeof(format_t) + maxpieces * sizeof(piece_t));
+    if (format == NULL) {
+        return NULL;
+    }
+    format->fmt = fmt;
+    format->file = file;
+    format->line = line;
+    format->level = level;
+
+    const char *start = fmt;
+    const char *p = fmt;
+    while (*p) {
+        if (*p != '%') {
+            p++;
+            continue;
+        }
+        if (p[1] == '%') {
+            p += 2;
+            continue;
+        }
+        p++;
+        p += strspn(p, "-+ #0");
+        p += strspn(p, "0123456789");
+        if (*p == '.') {
+            p++;
+            p += strspn(p, "0123456789");
+        }
+        int longs = 0;
+        bool size = false;
+        while (*p != '\0' && strchr("hljztL", *p) != NULL) {
+            longs += (*p == 'l') + 2 * (*p == 'j');
+            size |= (*p == 'z' || *p == 't');
+            if (*p == 'L') {
+                format->sync = true;
+            }
+            p++;
+        }
+
+        arg_type_t type;
+        if (*p != '\0' && strchr("diouxXc", *p) != NULL) {
+            type = size ? ARG_SIZE : (longs == 0 ? ARG_INT : (longs == 1 ? ARG_LONG : ARG_LLONG));
+        }
+        else if (*p != '\0' && strchr("feEgGaA", *p) != NULL) {
+            type = ARG_DOUBLE;
+        }
+        else if (*p == 's' && longs == 0) {
+            type = ARG_STRING;
+        }
+        else if (*p == 'p') {
+            type = ARG_POINTER;
+        }
+        else {
+            format->sync = true;        // '*', %n, %ls, ...
+            break;
+        }
+        p++;
+        format->pieces[format->npieces++] = (piece_t) {
+            fmt: copy_piece(start, p - start),
+            type: type,
+        };
+        start = p;
+    }
+    if (*start) {
+        format->pieces[format->npieces++] = (piece_t) {
+            fmt: copy_piece(start, strlen(start)),
+            type: ARG_NONE,
+        };
+    }
+    for (int i = 0; i < format->npieces; i++) {
+        if (format->pieces[i].fmt == NULL) {
+            free_format(format);
+            return NULL;
+        }
+    }
+    // Every piece must fit in a record, even if it is a string.
+    if (2 * format->npieces >= MAX_RECORD_WORDS) {
+        format->sync = true;
+    }
+    return format;
+}
+
+/* Find the id of the format for this log statement, adding it if this is
+ * its first record. Returns 0 if it must be logged synchronously.
+ */
+static int format_id(int level, const char *file, int line, const char *fmt) {
+    uintptr_t hash = ((uintptr_t) fmt ^ (uintptr_t) file * 31 ^ line * 0x9e3779b1u) + level;
+    hash ^= hash >> 17;
+    for (int probe = 0; probe < MAX_FORMATS; probe++) {
+        int slot = (hash + probe) & (MAX_FORMATS - 1);
+        format_t *format = __atomic_load_n(&formats[slot], __ATOMIC_ACQUIRE);
+        if (format == NULL) {
+            format_t *new = parse_format(level, file, line, fmt);
+            if (new == NULL) {
+                return 0;
+            }
+            if (__atomic_compare_exchange_n(&formats[slot], &format, new, false,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                format = new;
+            }
+            else {
+                // Another thread took the slot first: see what it put there.
+                free_format(new);
+            }
+        }
+        if (format->fmt == fmt && format->file == file &&
+            format->line == line && format->level == level) {
+            return format->sync ? 0 : slot + 1;
+        }
+    }
+    return 0;
+}
+
+static ring_t *new_ring(int worker) {
+    ring_t *ring = alloc_calloc(1, sizeof(ring_t) + ring_words * sizeof(uint64_t));
+    if (ring == NULL) {
+        return NULL;
+    }
+    ring->worker = worker;
+    ring->nwords = ring_words;
+    int i = __atomic_fetch_add(&nrings, 1, __ATOMIC_RELAXED);
+    if (i >= ASYNC_LOG_MAX_THREADS) {
+        alloc_free(ring);
+        return NULL;
+    }
+    __atomic_store_n(&rings[i], ring, __ATOMIC_RELEASE);
+    return ring;
+}
+
+/* Append a record to ring, waiting for the writer if it is full. */
+static void ring_put(ring_t *ring, uint64_t record[], uint32_t nwords) {
+    uint64_t head = ring->head;
+    uint64_t pos = head & (ring->nwords - 1);
+    uint64_t pad = (pos + nwords > ring->nwords) ? ring->nwords - pos : 0;
+
+    while (head + pad + nwords - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) > ring->nwords) {
+        ring->waits++;
+        pause_ns(10000);
+    }
+    if (pad > 0) {
+        record_header_t header = {id: 0, nwords: pad, game: 0};
+        memcpy(&ring->words[pos], &header, sizeof(header));
+        head += pad;
+        pos = 0;
+    }
+    memcpy(&ring->words[pos], record, nwords * sizeof(uint64_t));
+    __atomic_store_n(&ring->head, head + nwords, __ATOMIC_RELEASE);
+}
+
+void async_log(int level, const char *file, int line, const char *fmt, ...) {
+    va_list ap;
+    int id = format_id(level, file, line, fmt);
+    unsigned gen = __atomic_load_n(&generation, __ATOMIC_ACQUIRE);
+    if (my_generation != gen) {
+        my_ring = NULL;             // from an earlier run, and freed
+        my_generation = gen;
+    }
+    if (my_ring == NULL && id != 0) {
+        my_ring = new_ring(my_worker);
+    }
+    if (id == 0 || my_ring == NULL) {
+        char buf[1024];
+        va_start(ap, fmt);
+        vsnprintf(buf, sizeof(buf), fmt, ap);
+        va_end(ap);
+        // log_log() writes to stderr in several calls too: hold its lock,
+        // like write_record() does, so lines stay whole.
+        flockfile(stderr);
+        log_log(level, file, line, "%s", buf);
+        funlockfile(stderr);
+        return;
+    }
+
+    format_t *format = formats[id - 1];
+    uint64_t record[MAX_RECORD_WORDS];
+    record_header_t header = {id: id, nwords: 0, game: my_game};
+    uint32_t n = 1;
+
+    va_start(ap, fmt);
+    for (int i = 0; i < format->npieces; i++) {
+        switch (format->pieces[i].type) {
+        case ARG_NONE:
+            break;
+        case ARG_INT:
+            record[n++] = (int64_t) va_arg(ap, int);
+            break;
+        case ARG_LONG:
+            record[n++] = (int64_t) va_arg(ap, long);
+            break;
+        case ARG_LLONG:
+            record[n++] = (int64_t) va_arg(ap, long long);
+            break;
+        case ARG_SIZE:
+            record[n++] = va_arg(ap, size_t);
+            break;
+        case ARG_DOUBLE: {
+            double value = va_arg(ap, double);
+            memcpy(&record[n++], &value, sizeof(value));
+            break;
+        }
+        case ARG_POINTER:
+            record[n++] = (uintptr_t) va_arg(ap, void *);
+            break;
+        case ARG_STRING: {
+            const char *s = va_arg(ap, const char *);
+            if (s == NULL) {
+                s = "(null)";
+            }
+            // Truncate to whatever fits in the record, leaving two words
+            // for each piece still to come.
+            size_t room = (MAX_RECORD_WORDS - n - 1 - 2 * (format->npieces - i - 1)) * sizeof(uint64_t);
+            size_t len = strnlen(s, room - 1);
+            record[n++] = len;
+            memcpy(&record[n], s, len);
+            ((char *) &record[n])[len] = '\0';
+            n += (len + sizeof(uint64_t)) / sizeof(uint64_t);
+            break;
+        }
+        }
+    }
+    va_end(ap);
+
+    header.nwords = n;
+    memcpy(&record[0], &header, sizeof(header));
+    ring_put(my_ring, record, n);
+
+    // Whatever comes next (usually exit()) must not lose this one.
+    if (level == LOG_FATAL) {
+        async_log_flush();
+    }
+}
+
+/* Format one record (not padding) from ring. */
+static void write_record(ring_t *ring, uint64_t *words) {
+    record_header_t header;
+    memcpy(&header, words, sizeof(header));
+    format_t *format = formats[header.id - 1];
+
+    time_t now = time(NULL);
+    struct tm tm;
+    char timebuf[16];
+    localtime_r(&now, &tm);
+    timebuf[strftime(timebuf, sizeof(timebuf), "%H:%M:%S", &tm)] = '\0';
+    // One line, however many calls it takes: records logged synchronously
+    // (see async_log()) may be going to the same stream.
+    flockfile(output);
+    fprintf(output, "%s %-5s ", timebuf, log_level_string(format->level));
+    if (ring->worker == ASYNC_LOG_NO_WORKER) {
+        fprintf(output, "[main");
+    }
+    else {
+        fprintf(output, "[w%d", ring->worker);
+    }
+    if (header.game >= 0) {
+        fprintf(output, " g%d", header.game);
+    }
+    fprintf(output, "] %s:%d: ", format->file, format->line);
+
+    uint64_t *arg = words + 1;
+    for (int i = 0; i < format->npieces; i++) {
+        piece_t *piece = &format->pieces[i];
+        switch (piece->type) {
+        case ARG_NONE:
+            fprintf(output, piece->fmt, 0);
+            break;
+        case ARG_INT:
+            fprintf(output, piece->fmt, (int) *arg++);
+            break;
+        case ARG_LONG:
+            fprintf(output, piece->fmt, (long) *arg++);
+            break;
+        case ARG_LLONG:
+            fprintf(output, piece->fmt, (long long) *arg++);
+            break;
+        case ARG_SIZE:
+            fprintf(output, piece->fmt, (size_t) *arg++);
+            break;
+        case ARG_DOUBLE: {
+            double value;
+            memcpy(&value, arg++, sizeof(value));
+            fprintf(output, piece->fmt, value);
+            break;
+        }
+        case ARG_POINTER:
+            fprintf(output, piece->fmt, (void *) (uintptr_t) *arg++);
+            break;
+        case ARG_STRING: {
+            size_t len = *arg++;
+            fprintf(output, piece->fmt, (char *) arg);
+            arg += (len + sizeof(uint64_t)) / sizeof(uint64_t);
+            break;
+        }
+        }
+    }
+    fputc('\n', output);
+    funlockfile(output);
+}
+
+/* Write out everything currently in the rings. Returns false if there was
+ * nothing to write.
+ */
+static bool drain(void) {
+    bool wrote = false;
+    int n = __atomic_load_n(&nrings, __ATOMIC_RELAXED);
+    for (int i = 0; i < n && i < ASYNC_LOG_MAX_THREADS; i++) {
+        ring_t *ring = __atomic_load_n(&rings[i], __ATOMIC_ACQUIRE);
+        if (ring == NULL) {
+            continue;
+        }
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint64_t tail = ring->tail;
+        while (tail < head) {
+            uint64_t *words = &ring->words[tail & (ring->nwords - 1)];
+            record_header_t header;
+            memcpy(&header, words, sizeof(header));
+            if (header.id != 0) {
+                write_record(ring, words);
+            }
+            tail += header.nwords;
+            wrote = true;
+        }
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    }
+    if (wrote) {
+        fflush(output);
+    }
+    return wrote;
+}
+
+static void *run_writer(void *arg) {
+    while (!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE)) {
+        if (!drain()) {
+            pause_ns(1000000);
+        }
+    }
+    drain();
+    return NULL;
+}
+
+/* Start logging asynchronously to fp, with ring_size bytes of buffer per
+ * logging thread. Returns false (after logging why) if the writer thread
+ * cannot be started.
+ */
+bool async_log_start(FILE *fp, size_t ring_size) {
+    assert(!logging_async);
+    output = fp;
+    ring_words = 512;
+    while (ring_words * sizeof(uint64_t) < ring_size) {
+        ring_words *= 2;
+    }
+    stopping = false;
+    __atomic_add_fetch(&generation, 1, __ATOMIC_RELEASE);
+    if (pthread_create(&writer, NULL, run_writer, NULL) != 0) {
+        log_error("pthread_create() failed for async log writer");
+        return false;
+    }
+    logging_async = true;
+    return true;
+}
+
+/* Wait until everything logged so far has been written. */
+void async_log_flush(void) {
+    int n = __atomic_load_n(&nrings, __ATOMIC_RELAXED);
+    for (int i = 0; i < n && i < ASYNC_LOG_MAX_THREADS; i++) {
+        ring_t *ring = __atomic_load_n(&rings[i], __ATOMIC_ACQUIRE);
+        if (ring == NULL) {
+            continue;
+        }
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        while (__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) < head) {
+            pause_ns(50000);
+        }
+    }
+}
+
+/* Write out what is left and go back to synchronous logging. Every other
+ * thread that logged must be done by now.
+ */
+void async_log_stop(void) {
+    if (!logging_async) {
+        return;
+    }
+    logging_async = false;
+    __atomic_store_n(&stopping, true, __ATOMIC_RELEASE);
+    pthread_join(writer, NULL);
+
+    uint64_t waits = 0;
+    int n = nrings < ASYNC_LOG_MAX_THREADS ? nrings : ASYNC_LOG_MAX_THREADS;
+    for (int i = 0; i < n; i++) {
+        if (rings[i] != NULL) {
+            waits += rings[i]->waits;
+            alloc_free(rings[i]);
+            rings[i] = NULL;
+        }
+    }
+    nrings = 0;
+    my_ring = NULL;
+    log_debug("async log: %d thread(s), waited for the writer %lu time(s)",
+              n,
+              (unsigned long) waits);
+
+    for (int slot = 0; slot < MAX_FORMATS; slot++) {
+        if (formats[slot] != NULL) {
+            free_format(formats[slot]);
+            formats[slot] = NULL;
+        }
+    }
+}
+
+/* Tag records from the calling thread with worker. */
+void async_log_thread(int worker) {
+    my_worker = worker;
+}
+
+/* Tag records from the calling thread with game (-1 for none). */
+void async_log_game(int game) {
+    my_game = game;
+}
@@ -0,0 +1,41 @@
+#ifndef _ASYNC_LOG_H
+#define _ASYNC_LOG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// Asynchronous logging: while it is running, log_trace() etc. (see
+// logging.h) do not format anything. Each thread appends a compact binary
+// record -- the id of the log statement's format, then its arguments -- to
+// a ring buffer of its own, without locking, and a background thread
+// formats the records and writes them out. Every record is tagged with the
+// worker and game that logged it (see async_log_thread() and
+// async_log_game()), so the output of parallel games stays readable:
+//
+//   12:34:56 INFO  [w3 g1042] c/play.c:895: after 4 hand(s): ...
+//
+// Records from one thread come out in order; records from different
+// threads are interleaved as the writer finds them. If a thread's buffer
+// is full, logging waits for the writer rather than dropping records.
+//
+// Formats must be string literals (or at least never change): a format is
+// parsed once per call site. Formats that async logging cannot handle
+// (e.g. '*' widths) are formatted synchronously instead.
+
+// Tag for records from threads that never called async_log_thread().
+#define ASYNC_LOG_NO_WORKER (-1)
+
+// Maximum number of threads that can log while async logging is running.
+#define ASYNC_LOG_MAX_THREADS 256
+
+extern bool logging_async;
+
+bool async_log_start(FILE *fp, size_t ring_size);
+void async_log_stop(void);
+void async_log_flush(void);
+void async_log_thread(int worker);
+void async_log_game(int game);
+void async_log(int level, const char *file, int line, const char *fmt, ...);
+
+#endif
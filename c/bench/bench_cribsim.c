@@ -0,0 +1,703 @@
+#define _POSIX_C_SOURCE 200809L    // for clock_gettime(), getopt()
+
+/* Microbenchmarks for the kernels of the simulator, and for whole games.
+ *
+ * usage: bench_cribsim [-p] [-f filter] [-j json-file]
+ *
+ * Every benchmark runs over the same corpus of seeded deals, and is timed
+ * in (at least) 1000 laps of a few deals, or a single game: for each
+ * benchmark we report the median and 99th percentile ns/op over its laps,
+ * and ops/sec over the whole run. With fewer than 1000 laps there is no
+ * p99 to speak of, and it is reported as "-" (null in JSON). With -f, only benchmarks whose name contains filter are
+ * run; with -j, the results are also written to json-file, as an array
+ * of objects with the same fields.
+ *
+ * With -p, each benchmark also reports hardware counters per op (see
+ * perf_counters.h): cycles, instructions, IPC, branch misses, and L1d and
+ * last-level cache misses. They count the benchmark thread only, from
+ * the start of its timed loop to its end.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../alloc.h"
+#include "../canon.h"
+#include "../cards.h"
+#include "../discard_cache.h"
+#include "../discard_table.h"
+#include "../logging.h"
+#include "../peg_mc.h"
+#include "../peg_solver.h"
+#include "../play.h"
+#include "../rng.h"
+#include "../score.h"
+#include "../twiddle.h"
+#include "perf_counters.h"
+
+// Every benchmark runs over the same corpus of seeded deals, so that
+// alternative implementations are compared on identical input.
+#define NDEALS 10000
+#define SEED 42
+
+// Laps per benchmark, and deals per lap: enough laps that the 99th
+// percentile is more than just the slowest one.
+#define NLAPS 1000
+#define LAP_DEALS (NDEALS / NLAPS)
+#define MAX_LAPS NLAPS
+
+static deal_t deals[NDEALS];
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// The benchmark being run: laps are recorded by bench_lap(), and
+// bench_end() reports them.
+static struct {
+    char *name;
+    bool skip;
+    long nops;
+    double total_ns;
+    double lap_start;
+    int nlaps;
+    double lap_ns[MAX_LAPS];            // ns/op of each lap
+} bench;
+
+static bool use_counters = false;
+static char *filter = NULL;
+static FILE *json = NULL;
+static int njson = 0;
+
+/* Start (or restart) timing and counting the benchmark: for those with
+ * setup to do after bench_begin().
+ */
+static void bench_go(void) {
+    if (use_counters) {
+        perf_counters_start();
+    }
+    bench.lap_start = now_ns();
+}
+
+static bool bench_wanted(char *name) {
+    return filter == NULL || strstr(name, filter) != NULL;
+}
+
+/* Start the benchmark called name. Returns false if it is filtered out. */
+static bool bench_begin(char *name) {
+    bench.name = name;
+    bench.skip = !bench_wanted(name);
+    bench.nops = 0;
+    bench.total_ns = 0;
+    bench.nlaps = 0;
+    if (!bench.skip) {
+        bench_go();
+    }
+    return !bench.skip;
+}
+
+/* End a lap of nops ops, and start the next one. */
+static void bench_lap(long nops) {
+    double now = now_ns();
+    double elapsed = now - bench.lap_start;
+    bench.nops += nops;
+    bench.total_ns += elapsed;
+    if (bench.nlaps < MAX_LAPS) {
+        bench.lap_ns[bench.nlaps++] = elapsed / nops;
+    }
+    bench.lap_start = now_ns();
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(double *) a;
+    double y = *(double *) b;
+    return (x > y) - (x < y);
+}
+
+/* Report the benchmark, followed by a line for checksum (and any other
+ * details) if it is not NULL.
+ */
+static void bench_end(char *checksum) {
+    int64_t counts[PERF_NCOUNTERS];
+    perf_counters_stop(counts);
+    if (bench.skip || bench.nlaps == 0) {
+        return;
+    }
+    qsort(bench.lap_ns, bench.nlaps, sizeof(double), cmp_double);
+    double median = bench.lap_ns[bench.nlaps / 2];
+    double ops_sec = bench.nops / (bench.total_ns / 1e9);
+
+    // Nearest rank: 1% of the laps are slower than p99.
+    bool have_p99 = bench.nlaps >= NLAPS;
+    double p99 = bench.lap_ns[(bench.nlaps * 99 + 99) / 100 - 1];
+    char p99_buf[32];
+    snprintf(p99_buf, sizeof(p99_buf), have_p99 ? "%.1f" : "-", p99);
+
+    printf("%-32s %10ld ops %10.1f ns/op %10s p99 %14.0f ops/sec\n",
+           bench.name,
+           bench.nops,
+           median,
+           p99_buf,
+           ops_sec);
+    if (checksum != NULL) {
+        printf("%-32s %s\n", "", checksum);
+    }
+
+    // Counters per op, or -1 if not available.
+    double per_op[PERF_NCOUNTERS];
+    double ipc = -1;
+    bool have_counts = false;
+    for (int c = 0; c < PERF_NCOUNTERS; c++) {
+        per_op[c] = (counts[c] >= 0) ? (double) counts[c] / bench.nops : -1;
+        have_counts = have_counts || counts[c] >= 0;
+    }
+    if (counts[PERF_CYCLES] > 0 && counts[PERF_INSTRUCTIONS] >= 0) {
+        ipc = (double) counts[PERF_INSTRUCTIONS] / counts[PERF_CYCLES];
+    }
+    if (have_counts) {
+        printf("%-32s", "");
+        char *sep = " ";
+        for (int c = 0; c < PERF_NCOUNTERS; c++) {
+            if (per_op[c] < 0) {
+                continue;
+            }
+            printf("%s%.1f %s", sep, per_op[c], perf_counter_names[c]);
+            if (c == PERF_INSTRUCTIONS && ipc >= 0) {
+                printf(" (IPC %.2f)", ipc);
+            }
+            sep = ", ";
+        }
+        printf(" per op\n");
+    }
+
+    if (json != NULL) {
+        fprintf(json,
+                "%s\n  {\"name\": \"%s\", \"ops\": %ld, \"median_ns\": %.1f,"
+                " \"p99_ns\": %s, \"ops_per_sec\": %.0f, \"laps\": %d",
+                njson++ > 0 ? "," : "",
+                bench.name,
+                bench.nops,
+                median,
+                have_p99 ? p99_buf : "null",
+                ops_sec,
+                bench.nlaps);
+        if (have_counts) {
+            for (int c = 0; c < PERF_NCOUNTERS; c++) {
+                if (per_op[c] >= 0) {
+                    fprintf(json, ", \"%s_per_op\": %.2f", perf_counter_names[c], per_op[c]);
+                }
+            }
+            if (ipc >= 0) {
+                fprintf(json, ", \"ipc\": %.3f", ipc);
+            }
+        }
+        fprintf(json, "}");
+    }
+}
+
+/* Load player 0's six cards from deal into hand, sorted. */
+static void load_hand(hand_t *hand, deal_t *deal) {
+    hand_truncate(hand);
+    hand->starter = -1;
+    for (int i = 0; i < DEAL_HAND_CARDS; i++) {
+        hand_append(hand, deal->cards[i]);
+    }
+    sort_cards(hand->ncards, hand->cards);
+}
+
+/* Load player 0's first four cards from deal into hand, plus the starter. */
+static void load_show(hand_t *hand, deal_t *deal) {
+    hand_truncate(hand);
+    hand->starter = -1;
+    for (int i = 0; i < 4; i++) {
+        hand_append(hand, deal->cards[i]);
+    }
+    sort_cards(hand->ncards, hand->cards);
+    add_starter(hand, deal->cards[DEAL_STARTER]);
+}
+
+/* Score every 4-card keep of every hand in the corpus with scorer: the
+ * inner loop of discard_simple().
+ */
+static void bench_keeps(char *name, score_t (*scorer)(hand_t *)) {
+    if (!bench_begin(name)) {
+        return;
+    }
+    hand_t *hand = new_hand(DEAL_HAND_CARDS);
+    hand_t *keep = new_hand(4);
+    uint checksum = 0;
+
+    bench_go();
+    for (int d = 0; d < NDEALS; d++) {
+        load_hand(hand, &deals[d]);
+        for (int a = 0; a < 6; a++) {
+            for (int b = a + 1; b < 6; b++) {
+                hand_truncate(keep);
+                for (int i = 0; i < 6; i++) {
+                    if (i != a && i != b) {
+                        hand_append(keep, hand->cards[i]);
+                    }
+                }
+                checksum += scorer(keep).total;
+            }
+        }
+        if ((d + 1) % LAP_DEALS == 0) {
+            bench_lap(LAP_DEALS * 15);
+        }
+    }
+    char buf[64];
+    snprintf(buf, sizeof(buf), "checksum %u", checksum);
+    bench_end(buf);
+
+    alloc_free(keep);
+    alloc_free(hand);
+}
+
+static uint score_total(hand_t *hand) {
+    return score_hand(hand).total;
+}
+
+/* Score every show (player 0's first four cards plus the starter) in the
+ * corpus with counter.
+ */
+static void bench_count(char *name, uint (*counter)(hand_t *)) {
+    if (!bench_begin(name)) {
+        return;
+    }
+    hand_t *hands = calloc(NDEALS, sizeof(hand_t));
+    uint checksum = 0;
+
+    // Only the scoring is timed.
+    for (int d = 0; d < NDEALS; d++) {
+        hand_init(&hands[d], 5);
+        load_show(&hands[d], &deals[d]);
+    }
+    bench_go();
+    for (int d = 0; d < NDEALS; d++) {
+        checksum += counter(&hands[d]);
+        if ((d + 1) % LAP_DEALS == 0) {
+            bench_lap(LAP_DEALS);
+        }
+    }
+    char buf[64];
+    snprintf(buf, sizeof(buf), "checksum %u", checksum);
+    bench_end(buf);
+    free(hands);
+}
+
+static void visit_combo(int ncards, int indexes[], void *data) {
+    uint *checksum = data;
+    *checksum += indexes[0] * 7 + indexes[ncards - 1];
+}
+
+/* Enumerate the n-choose-m combinations once per deal in the corpus. */
+static void bench_combos(char *name, int n, int m) {
+    if (!bench_begin(name)) {
+        return;
+    }
+    uint checksum = 0;
+    for (int d = 0; d < NDEALS; d++) {
+        iter_combos(n, m, visit_combo, &checksum);
+        if ((d + 1) % LAP_DEALS == 0) {
+            bench_lap(LAP_DEALS);
+        }
+    }
+    char buf[64];
+    snprintf(buf, sizeof(buf), "checksum %u", checksum);
+    bench_end(buf);
+}
+
+/* Shuffle a full deck, or deal the 13 cards of a hand from it, NDEALS
+ * times.
+ */
+static void bench_deck(char *name, bool shuffle) {
+    if (!bench_begin(name)) {
+        return;
+    }
+    deck_t *deck = new_deck();
+    card_t cards[DEAL_NCARDS];
+    rng_t rng;
+    rng_init(&rng, SEED, 2);
+    uint checksum = 0;
+
+    bench_go();
+    for (int d = 0; d < NDEALS; d++) {
+        if (shuffle) {
+            shuffle_deck(deck, &rng);
+            checksum += card_code(deck->cards[0]);
+        }
+        else {
+            deal_cards(deck, &rng, DEAL_NCARDS, cards);
+            checksum += card_code(cards[0]);
+        }
+        if ((d + 1) % LAP_DEALS == 0) {
+            bench_lap(LAP_DEALS);
+        }
+    }
+    char buf[64];
+    snprintf(buf, sizeof(buf), "checksum %u", checksum);
+    bench_end(buf);
+    alloc_free(deck);
+}
+
+static int cmp_cards(const void *a, const void *b) {
+    return card_cmp((card_t *) a,  (card_t *) b);
+}
+
+static void qsort_cards(int ncards, card_t cards[]) {
+    qsort(cards, ncards, sizeof(card_t), cmp_cards);
+}
+
+/* Sort the first ncards cards of every deal in the corpus with sorter. */
+static void bench_sort(char *name, int ncards, void (*sorter)(int, card_t[])) {
+    if (!bench_begin(name)) {
+        return;
+    }
+    card_t cards[DEAL_NCARDS];
+    uint checksum = 0;
+
+    for (int d = 0; d < NDEALS; d++) {
+        memcpy(cards, deals[d].cards, ncards);
+        sorter(ncards, cards);
+        checksum += card_code(cards[0]) + card_code(cards[ncards - 1]);
+        if ((d + 1) % LAP_DEALS == 0) {
+            bench_lap(LAP_DEALS);
+        }
+    }
+    char buf[64];
+    snprintf(buf, sizeof(buf), "checksum %u", checksum);
+    bench_end(buf);
+}
+
+static void bench_discard(char *name, discard_func_t discard, void *data) {
+    if (!bench_begin(name)) {
+        return;
+    }
+    hand_t *hand = new_hand(DEAL_HAND_CARDS);
+    hand_t *crib = new_hand(4);
+    rng_t rng;
+    rng_init(&rng, SEED, 1);
+    discard_ctx_t ctx = {dealer: false, rng: &rng, data: data};
+
+    bench_go();
+    for (int d = 0; d < NDEALS; d++) {
+        load_hand(hand, &deals[d]);
+        hand_truncate(crib);
+        ctx.dealer = d % 2;
+        discard(hand, crib, &ctx);
+        if ((d + 1) % LAP_DEALS == 0) {
+            bench_lap(LAP_DEALS);
+        }
+    }
+    bench_end(NULL);
+
+    alloc_free(crib);
+    alloc_free(hand);
+}
+
+static bool ignore_points(void *data, int player, uint points) {
+    return false;
+}
+
+/* Load the first four cards of each player's hand in deal, sorted. */
+static void load_peg_hands(hand_t *hands[2], deal_t *deal) {
+    for (int p = 0; p < 2; p++) {
+        hand_init(hands[p], 4);
+        for (int i = 0; i < 4; i++) {
+            hand_append(hands[p], deal->cards[p * DEAL_HAND_CARDS + i]);
+        }
+        sort_cards(4, hands[p]->cards);
+    }
+}
+
+/* Peg the first four cards of each player's hand in every deal. */
+static void bench_peg(char *name, peg_func_t select, int ndeals) {
+    if (!bench_begin(name)) {
+        return;
+    }
+    hand_t hand_0, hand_1;
+    hand_t *hands[2] = {&hand_0, &hand_1};
+    peg_func_t select_funcs[2] = {select, select};
+    peg_state_t peg;
+    uint checksum = 0;
+    int lap_deals = (ndeals + NLAPS - 1) / NLAPS;
+
+    bench_go();
+    for (int d = 0; d < ndeals; d++) {
+        load_peg_hands(hands, &deals[d]);
+        peg_state_reset(&peg, 4);
+        peg_hands(2, &peg, hands, NULL, CARD_NONE, select_funcs, ignore_points, NULL);
+        checksum += peg.points[0] * 31 + peg.points[1];
+        if ((d + 1) % lap_deals == 0) {
+            bench_lap(lap_deals);
+        }
+    }
+    char buf[64];
+    snprintf(buf, sizeof(buf), "checksum %u", checksum);
+    bench_end(buf);
+}
+
+/* Solve the pegging of the first four cards of each player's hand in
+ * every deal, with or without the principal variation.
+ */
+static void bench_peg_solve(char *name, bool with_pv) {
+    if (!bench_begin(name)) {
+        return;
+    }
+    hand_t hand_0, hand_1;
+    hand_t *hands[2] = {&hand_0, &hand_1};
+    peg_solver_t *solver = new_peg_solver(16);
+    peg_solution_t solution;
+    int checksum = 0;
+
+    bench_go();
+    for (int d = 0; d < NDEALS; d++) {
+        load_peg_hands(hands, &deals[d]);
+        checksum += peg_solve_hands(solver, hands, with_pv ? &solution : NULL);
+        if ((d + 1) % LAP_DEALS == 0) {
+            bench_lap(LAP_DEALS);
+        }
+    }
+    char buf[64];
+    snprintf(buf, sizeof(buf), "checksum %d, %.1f positions/op",
+             checksum,
+             (double) solver->nodes / NDEALS);
+    bench_end(buf);
+    peg_solver_free(solver);
+}
+
+/* Canonicalize every 6-card hand in the corpus, with and without the
+ * starter.
+ */
+static void bench_canon(char *name, bool with_starter) {
+    if (!bench_begin(name)) {
+        return;
+    }
+    hand_t *hand = new_hand(DEAL_HAND_CARDS + 1);
+    canon_t canon;
+    uint checksum = 0;
+
+    bench_go();
+    for (int d = 0; d < NDEALS; d++) {
+        load_hand(hand, &deals[d]);
+        if (with_starter) {
+            hand_delete(hand, 0);
+            hand_delete(hand, 0);
+            append_starter(hand, deals[d].cards[DEAL_STARTER]);
+        }
+        canon_hand(&canon, hand);
+        checksum += canon.index;
+        if ((d + 1) % LAP_DEALS == 0) {
+            bench_lap(LAP_DEALS);
+        }
+    }
+    char buf[64];
+    snprintf(buf, sizeof(buf), "checksum %u", checksum);
+    bench_end(buf);
+
+    alloc_free(hand);
+}
+
+/* Play whole games, as cribsim does, with logging at LOG_INFO (but
+ * discarded, so that writing it out is not part of the measurement).
+ */
+static void bench_games(char *name, discard_func_t discard, int ngames) {
+    if (!bench_begin(name)) {
+        return;
+    }
+    strategy_t strategy[2] = {
+        (strategy_t) {peg_func: peg_select_low, discard_func: discard},
+        (strategy_t) {peg_func: peg_select_low, discard_func: discard},
+    };
+    deck_t *deck = new_deck();
+    rng_t rng;
+    uint checksum = 0;
+    int lap_games = (ngames + NLAPS - 1) / NLAPS;
+
+    log_set_quiet(true);
+    bench_go();
+    for (int g = 0; g < ngames; g++) {
+        rng_init(&rng, SEED, g);
+        checksum += play_game(strategy, deck, &rng);
+        if ((g + 1) % lap_games == 0) {
+            bench_lap(lap_games);
+        }
+    }
+    log_set_quiet(false);
+
+    char buf[64];
+    snprintf(buf, sizeof(buf), "checksum %u", checksum);
+    bench_end(buf);
+    alloc_free(deck);
+}
+
+/* Log one play_game()-like record per op to /dev/null: formatted on the
+ * spot by log.c, or queued for the async log writer. The ring is big
+ * enough for every record, so the async numbers are what a caller pays.
+ */
+static void bench_log(void) {
+    // These run together (or not at all): -f only picks what is shown.
+    if (!bench_wanted("log_info: log.c") &&
+        !bench_wanted("log_info: async_log") &&
+        !bench_wanted("async_log: writer (per record)")) {
+        return;
+    }
+    FILE *devnull = fopen("/dev/null", "w");
+    int nops = NDEALS;
+
+    // There is no way to remove a log.c callback, so this has to be the
+    // last benchmark that logs anything.
+    log_set_quiet(true);
+    log_add_fp(devnull, LOG_INFO);
+    bench_begin("log_info: log.c");
+    for (int i = 0; i < nops; i++) {
+        log_info("after %d hand(s): scores={a: %d, b: %d}, no winner yet", i, i * 3, i * 5);
+        if ((i + 1) % LAP_DEALS == 0) {
+            bench_lap(LAP_DEALS);
+        }
+    }
+    bench_end(NULL);
+
+    async_log_start(devnull, 1 << 20);
+    bench_begin("log_info: async_log");
+    for (int i = 0; i < nops; i++) {
+        log_info("after %d hand(s): scores={a: %d, b: %d}, no winner yet", i, i * 3, i * 5);
+        if ((i + 1) % LAP_DEALS == 0) {
+            bench_lap(LAP_DEALS);
+        }
+    }
+    bench_end(NULL);
+
+    // The writer drains the ring in one go: a single lap.
+    bench_begin("async_log: writer (per record)");
+    async_log_stop();
+    bench_lap(nops);
+    bench_end(NULL);
+    log_set_quiet(false);
+}
+
+static void usage(char *prog) {
+    fprintf(stderr, "usage: %s [-p] [-f filter] [-j json-file]\n", prog);
+    exit(2);
+}
+
+int main(int argc, char *argv[]) {
+    char *json_path = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "pf:j:")) != -1) {
+        switch (opt) {
+        case 'p':
+            use_counters = true;
+            break;
+        case 'f':
+            filter = optarg;
+            break;
+        case 'j':
+            json_path = optarg;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind < argc) {
+        usage(argv[0]);
+    }
+    if (json_path != NULL) {
+        json = fopen(json_path, "w");
+        if (json == NULL) {
+            perror(json_path);
+            exit(1);
+        }
+        fprintf(json, "[");
+    }
+    if (use_counters) {
+        use_counters = perf_counters_open();
+    }
+    logging_set_level(LOG_INFO);
+
+    deck_t *deck = new_deck();
+    rng_t rng;
+    rng_init(&rng, SEED, 0);
+    deal_batch(deck, &rng, NDEALS, deals);
+    alloc_free(deck);
+
+    // Make sure one-time initialization is not part of any measurement.
+    hand_t *hand = new_hand(DEAL_HAND_CARDS);
+    load_hand(hand, &deals[0]);
+    score_hand(hand);
+    canon_count(0, false);
+
+    bench_keeps("score keeps: score_hand_reference", score_hand_reference);
+    bench_keeps("score keeps: score_hand", score_hand);
+    bench_count("score_hand: 4 cards + starter", score_total);
+    bench_count("count_15s: 4 cards + starter", count_15s);
+    bench_count("count_runs: 4 cards + starter", count_runs);
+    bench_count("count_flush: 4 cards + starter", count_flush);
+    bench_combos("iter_combos: 6 choose 4", 6, 4);
+    bench_deck("shuffle_deck", true);
+    bench_deck("deal_cards: 13 cards", false);
+
+    bench_discard("discard_simple", discard_simple, NULL);
+    bench_discard("discard_expected", discard_expected, NULL);
+
+    // Once to fill the cache, once to measure hits: if -f picks either,
+    // both run.
+    if (bench_wanted("discard_cached: cold") || bench_wanted("discard_cached: warm")) {
+        char *save_filter = filter;
+        filter = NULL;
+        discard_cache_t *cache = new_discard_cache(discard_expected, NULL, 8 << 20);
+        bench_discard("discard_cached: cold", discard_cached, cache);
+        bench_discard("discard_cached: warm", discard_cached, cache);
+        discard_cache_free(cache);
+        filter = save_filter;
+    }
+
+    // Only the hands in the corpus need entries.
+    if (bench_wanted("discard_table")) {
+        discard_table_t *table = new_discard_table(false);
+        for (int d = 0; d < NDEALS; d++) {
+            canon_t canon;
+            load_hand(hand, &deals[d]);
+            canon_hand(&canon, hand);
+            discard_table_fill(table, canon.hand);
+        }
+        bench_discard("discard_table", discard_table, table);
+        discard_table_free(table);
+    }
+    alloc_free(hand);
+
+    bench_canon("canon_hand: 6 cards", false);
+    bench_canon("canon_hand: 4 cards + starter", true);
+
+    bench_peg("peg_hands: peg_select_low", peg_select_low, NDEALS);
+    bench_peg("peg_hands: peg_select_high", peg_select_high, NDEALS);
+    bench_peg("peg_hands: peg_select_greedy", peg_select_greedy, NDEALS);
+    bench_peg("peg_hands: peg_select_mc", peg_select_mc, NDEALS / 10);
+    bench_peg_solve("peg_solve: value", false);
+    bench_peg_solve("peg_solve: value + PV", true);
+
+    bench_sort("sort 5 cards: qsort", 5, qsort_cards);
+    bench_sort("sort 5 cards: sort_cards", 5, sort_cards);
+    bench_sort("sort 6 cards: qsort", 6, qsort_cards);
+    bench_sort("sort 6 cards: sort_cards", 6, sort_cards);
+    bench_sort("sort 7 cards: qsort", 7, qsort_cards);
+    bench_sort("sort 7 cards: sort_cards", 7, sort_cards);
+
+    bench_games("play_game: discard_simple", discard_simple, 1000);
+    bench_games("play_game: discard_expected", discard_expected, 1000);
+
+    bench_log();
+
+    if (json != NULL) {
+        fprintf(json, "\n]\n");
+        fclose(json);
+    }
+    perf_counters_close();
+    return 0;
+}
@@ -0,0 +1,144 @@
+#define _GNU_SOURCE                 // for syscall()
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+#include "perf_counters.h"
+
+const char *perf_counter_names[PERF_NCOUNTERS] = {
+    "cycles",
+    "instructions",
+    "branch-misses",
+    "L1d-misses",
+    "LLC-misses",
+};
+
+static const struct {
+    uint32_t type;
+    uint64_t config;
+} events[PERF_NCOUNTERS] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {PERF_TYPE_HW_CACHE, (PERF_COUNT_HW_CACHE_L1D |
+                          PERF_COUNT_HW_CACHE_OP_READ << 8 |
+                          PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+};
+
+// File descriptor of each counter, or -1. The first one that opens leads
+// the group, so that they are all scheduled onto the PMU together.
+static int fds[PERF_NCOUNTERS] = {-1, -1, -1, -1, -1};
+static int leader = -1;
+
+// With PERF_FORMAT_GROUP, one read() gets every counter in the group, in
+// the order they were opened.
+typedef struct {
+    uint64_t nr;
+    uint64_t time_enabled;
+    uint64_t time_running;
+    uint64_t values[PERF_NCOUNTERS];
+} group_read_t;
+
+static int open_counter(int counter, int group_fd) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = events[counter].type;
+    attr.config = events[counter].config;
+    attr.disabled = (group_fd == -1);
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = (PERF_FORMAT_GROUP |
+                        PERF_FORMAT_TOTAL_TIME_ENABLED |
+                        PERF_FORMAT_TOTAL_TIME_RUNNING);
+    return syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+/* Open whichever counters this machine has, for the calling thread.
+ * Returns false (after saying why on stderr) if there are none.
+ */
+bool perf_counters_open(void) {
+    int errors[PERF_NCOUNTERS];
+    for (int c = 0; c < PERF_NCOUNTERS; c++) {
+        fds[c] = open_counter(c, leader);
+        if (fds[c] == -1) {
+            errors[c] = errno;
+            continue;
+        }
+        if (leader == -1) {
+            leader = fds[c];
+        }
+    }
+    if (leader == -1) {
+        fprintf(stderr, "perf counters unavailable (%s): reporting wall-clock time only\n",
+                strerror(errors[0]));
+        return false;
+    }
+    for (int c = 0; c < PERF_NCOUNTERS; c++) {
+        if (fds[c] == -1) {
+            fprintf(stderr, "perf counter %s unavailable (%s)\n",
+                    perf_counter_names[c],
+                    strerror(errors[c]));
+        }
+    }
+    return true;
+}
+
+void perf_counters_close(void) {
+    for (int c = 0; c < PERF_NCOUNTERS; c++) {
+        if (fds[c] != -1) {
+            close(fds[c]);
+            fds[c] = -1;
+        }
+    }
+    leader = -1;
+}
+
+/* Reset the counters and start counting. */
+void perf_counters_start(void) {
+    if (leader == -1) {
+        return;
+    }
+    ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+/* Stop counting, and return the counts since perf_counters_start(), or
+ * -1 for counters that are not available (including all of them if the
+ * group never got onto the PMU). If the kernel had to multiplex the
+ * counters, the counts are scaled up to the whole interval.
+ */
+void perf_counters_stop(int64_t values[PERF_NCOUNTERS]) {
+    for (int c = 0; c < PERF_NCOUNTERS; c++) {
+        values[c] = -1;
+    }
+    if (leader == -1) {
+        return;
+    }
+    ioctl(leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+    group_read_t data;
+    if (read(leader, &data, sizeof(data)) < (ssize_t) (3 * sizeof(uint64_t))) {
+        return;
+    }
+    // Never scheduled: the zeros are not a measurement.
+    if (data.time_running == 0) {
+        return;
+    }
+    double scale = 1.0;
+    if (data.time_running < data.time_enabled) {
+        scale = (double) data.time_enabled / data.time_running;
+    }
+    int i = 0;
+    for (int c = 0; c < PERF_NCOUNTERS && i < data.nr; c++) {
+        if (fds[c] != -1) {
+            values[c] = (int64_t) (data.values[i++] * scale);
+        }
+    }
+}
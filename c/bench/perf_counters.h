@@ -0,0 +1,33 @@
+#ifndef _PERF_COUNTERS_H
+#define _PERF_COUNTERS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Hardware performance counters for the benchmarks, through
+// perf_event_open(2): user-space cycles, instructions, branch misses, and
+// L1 data / last-level cache misses of this thread, counted between
+// perf_counters_start() and perf_counters_stop().
+//
+// Counters are often missing -- in containers and VMs, or with
+// kernel.perf_event_paranoid > 2 -- so every one is optional: those that
+// cannot be opened read as -1, and if none can, perf_counters_open()
+// returns false and the rest is a no-op. Counters that open but never get
+// scheduled onto the PMU read as -1 too, not 0.
+typedef enum {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_BRANCH_MISSES,
+    PERF_L1D_MISSES,
+    PERF_LLC_MISSES,
+    PERF_NCOUNTERS,
+} perf_counter_t;
+
+extern const char *perf_counter_names[PERF_NCOUNTERS];
+
+bool perf_counters_open(void);
+void perf_counters_close(void);
+void perf_counters_start(void);
+void perf_counters_stop(int64_t values[PERF_NCOUNTERS]);
+
+#endif
@@ -0,0 +1,221 @@
+#define _POSIX_C_SOURCE 200809L    // for pthread_once()
+
+#include <assert.h>
+#include <pthread.h>
+
+#include "canon.h"
+
+// The index of a hand is built from each suit's "shape" -- the number of
+// cards in the suit, and whether the starter is in it -- and the index of
+// the suit's ranks among all rank sets of that shape:
+//
+//   - The four shapes, sorted, make the hand's configuration (e.g. 3 + 2
+//     + 1 + 0 cards). Every configuration gets its own range of indexes,
+//     starting at config_offset[].
+//   - Within a configuration, suits with different shapes are
+//     independent: their indexes combine in mixed radix.
+//   - Suits with the same shape are interchangeable, so what matters is
+//     the multiset of their rank set indexes, which is numbered the same
+//     way as rank multisets in score.c.
+//
+// Sorting the suits by (shape, rank set index) gives the canonical order.
+
+#define NSUITS 4
+#define RANK_SETS (1 << 13)
+
+// shape = 2 * (cards in suit) + (1 if the starter is in the suit)
+#define NSHAPES (2 * CANON_MAX_CARDS + 2)
+
+// Suits can only share a shape if they hold at most half of the cards
+// (and no starter), so multiset indexes never need C(n, k) for n >= this.
+#define MULTI_CHOOSE_MAX 290
+
+// For each rank set: its index among the sets of the same size, plus the
+// size in the top bits (cheaper than a popcount without -mpopcnt).
+#define LANE_SIZE_SHIFT 12
+static uint16_t lane_info[RANK_SETS];
+static uint32_t shape_size[NSHAPES];                // rank sets per shape
+static uint32_t group_radix[NSHAPES][NSUITS + 1];   // multisets of k rank sets
+static uint32_t multi_choose[MULTI_CHOOSE_MAX][NSUITS + 1];
+static uint32_t config_offset[1 << (4 * NSUITS)];   // by packed sorted shapes
+static uint32_t config_count[CANON_MAX_CARDS + 1][2];
+static pthread_once_t canon_once = PTHREAD_ONCE_INIT;
+
+static uint64_t choose(uint64_t n, int k) {
+    uint64_t result = 1;
+    for (int i = 0; i < k; i++) {
+        if (n < i + 1) {
+            return 0;
+        }
+        result = result * (n - i) / (i + 1);
+    }
+    return result;
+}
+
+/* Number every configuration of nsuits shapes, each no bigger than
+ * max_shape, with ncards cards and nstarters starters between them.
+ */
+static void number_configs(int suit,
+                           int max_shape,
+                           uint32_t key,
+                           uint64_t size,
+                           int ncards,
+                           int nstarters,
+                           int group_shape,
+                           int group_len) {
+    if (suit == NSUITS) {
+        size *= group_radix[group_shape][group_len];
+        assert(config_count[ncards][nstarters] + size <= UINT32_MAX);
+        config_offset[key] = config_count[ncards][nstarters];
+        config_count[ncards][nstarters] += size;
+        return;
+    }
+    for (int shape = max_shape; shape >= 0; shape--) {
+        int total_cards = ncards + shape / 2;
+        int total_starters = nstarters + shape % 2;
+        if (total_cards > CANON_MAX_CARDS || total_starters > 1) {
+            continue;
+        }
+        uint32_t next_key = key | (uint32_t) shape << (4 * (NSUITS - 1 - suit));
+        if (suit > 0 && shape == group_shape) {
+            number_configs(suit + 1, shape, next_key, size,
+                           total_cards, total_starters, shape, group_len + 1);
+        }
+        else {
+            uint64_t next_size = (suit == 0) ? 1 : size * group_radix[group_shape][group_len];
+            number_configs(suit + 1, shape, next_key, next_size,
+                           total_cards, total_starters, shape, 1);
+        }
+    }
+}
+
+static void init_canon(void) {
+    for (uint lane = 0; lane < RANK_SETS; lane++) {
+        uint index = 0;
+        int i = 0;
+        for (int bit = 0; bit < 13; bit++) {
+            if (lane & (1 << bit)) {
+                index += choose(bit, ++i);
+            }
+        }
+        assert(index < (1 << LANE_SIZE_SHIFT));
+        lane_info[lane] = index | i << LANE_SIZE_SHIFT;
+    }
+    for (int n = 0; n < MULTI_CHOOSE_MAX; n++) {
+        for (int k = 0; k <= NSUITS; k++) {
+            multi_choose[n][k] = choose(n, k);
+        }
+    }
+    for (int shape = 0; shape < NSHAPES; shape++) {
+        int ncards = shape / 2;
+        shape_size[shape] = choose(13, ncards) * (shape % 2 ? 13 - ncards : 1);
+        for (int k = 0; k <= NSUITS; k++) {
+            uint64_t radix = choose(shape_size[shape] + k - 1, k);
+            group_radix[shape][k] = radix <= UINT32_MAX ? radix : 0;
+        }
+    }
+    number_configs(0, NSHAPES - 1, 0, 1, 0, 0, 0, 0);
+}
+
+/* Return the number of classes of hands with ncards cards (not counting
+ * the starter), plus a starter if starter is true.
+ */
+uint32_t canon_count(int ncards, bool starter) {
+    assert(ncards <= CANON_MAX_CARDS);
+    pthread_once(&canon_once, init_canon);
+    return config_count[ncards][starter];
+}
+
+/* Order *a and *b so that *a >= *b. Written to compile to conditional
+ * moves: suit keys are effectively random, so branches would mispredict.
+ */
+static inline void sort_keys(uint32_t *a, uint32_t *b) {
+    uint32_t hi = *a > *b ? *a : *b;
+    uint32_t lo = *a > *b ? *b : *a;
+    *a = hi;
+    *b = lo;
+}
+
+/* Canonicalize hand (a set of at most CANON_MAX_CARDS cards) and starter
+ * (SUIT_NONE if there is none; must not be in hand).
+ */
+void canon_mask(canon_t *canon, handmask_t hand, card_t starter) {
+    assert(handmask_count(hand) <= CANON_MAX_CARDS);
+    assert(starter.suit == SUIT_NONE || !handmask_has(hand, starter));
+    pthread_once(&canon_once, init_canon);
+
+    // Sort key for each suit: shape, then rank set index, then the suit
+    // itself (only to keep the order of identical suits deterministic).
+    uint32_t keys[NSUITS];
+    for (int s = 0; s < NSUITS; s++) {
+        uint lane = handmask_suit(hand, SUIT_CLUB + s);
+        uint ncards = lane_info[lane] >> LANE_SIZE_SHIFT;
+        uint shape = 2 * ncards;
+        uint index = lane_info[lane] & ((1 << LANE_SIZE_SHIFT) - 1);
+        if (starter.suit == SUIT_CLUB + s) {
+            uint below = ~lane & ((1u << (starter.rank - RANK_ACE)) - 1);
+            shape++;
+            index = index * (13 - ncards) + (lane_info[below] >> LANE_SIZE_SHIFT);
+        }
+        keys[s] = shape << 24 | index << 2 | s;
+    }
+    sort_keys(&keys[0], &keys[1]);
+    sort_keys(&keys[2], &keys[3]);
+    sort_keys(&keys[0], &keys[2]);
+    sort_keys(&keys[1], &keys[3]);
+    sort_keys(&keys[1], &keys[2]);
+
+    canon->hand = 0;
+    canon->to_canon[SUIT_NONE] = SUIT_NONE;
+    canon->from_canon[SUIT_NONE] = SUIT_NONE;
+    uint32_t config = 0;
+    for (int c = 0; c < NSUITS; c++) {
+        suit_t suit = SUIT_CLUB + (keys[c] & 3);
+        canon->to_canon[suit] = SUIT_CLUB + c;
+        canon->from_canon[SUIT_CLUB + c] = suit;
+        canon->hand |= (handmask_t) handmask_suit(hand, suit) << (c * HANDMASK_LANE_BITS);
+        config |= (keys[c] >> 24) << (4 * (NSUITS - 1 - c));
+    }
+    canon->starter = starter;
+    canon->starter.suit = canon->to_canon[starter.suit];
+
+    // Combine groups of suits with the same shape in mixed radix.
+    uint32_t index = 0;
+    for (int first = 0; first < NSUITS; ) {
+        uint shape = keys[first] >> 24;
+        int last = first + 1;
+        while (last < NSUITS && keys[last] >> 24 == shape) {
+            last++;
+        }
+        int len = last - first;
+        uint32_t group = (keys[last - 1] >> 2) & 0x3fffff;
+        if (len > 1) {
+            // Number the multiset of rank set indexes, smallest first.
+            for (int i = 1; i < len; i++) {
+                uint value = ((keys[last - 1 - i] >> 2) & 0x3fffff) + i;
+                assert(value < MULTI_CHOOSE_MAX);
+                group += multi_choose[value][i + 1];
+            }
+        }
+        index = index * group_radix[shape][len] + group;
+        first = last;
+    }
+    canon->index = config_offset[config] + index;
+}
+
+/* Canonicalize hand, treating hand->cards[hand->starter] (if any) as the
+ * starter.
+ */
+void canon_hand(canon_t *canon, hand_t *hand) {
+    handmask_t mask = 0;
+    card_t starter = {suit: SUIT_NONE, rank: RANK_JOKER};
+    for (int i = 0; i < hand->ncards; i++) {
+        if (i == hand->starter) {
+            starter = hand->cards[i];
+        }
+        else {
+            mask |= card_mask(hand->cards[i]);
+        }
+    }
+    canon_mask(canon, mask, starter);
+}
@@ -0,0 +1,50 @@
+#ifndef _CANON_H
+#define _CANON_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "cards.h"
+#include "handmask.h"
+
+// Suit isomorphism: hands that only differ by a permutation of suits score
+// the same and play the same, so anything computed for one of them can be
+// reused for all of them. canon_hand() maps a hand (and optionally its
+// starter, which is kept apart from the other cards) to:
+//
+//   - a canonical representative of its class: suits are renamed so that
+//     the "biggest" suit of the hand becomes clubs, the next diamonds, and
+//     so on;
+//   - a dense index of the class among all classes of hands with the same
+//     number of cards (with or without a starter): 0 .. canon_count() - 1;
+//   - the suit permutation that maps the hand to its canonical form, and
+//     back.
+//
+// For example, the 20,358,520 6-card hands fall into 962,988 classes.
+
+// Biggest hand that can be canonicalized, not counting the starter.
+#define CANON_MAX_CARDS 6
+
+typedef struct {
+    handmask_t hand;                    // canonical cards (without starter)
+    card_t starter;                     // canonical starter, or {0, 0}
+    uint32_t index;                     // dense index of the class
+    suit_t to_canon[SUIT_SPADE + 1];    // original suit -> canonical suit
+    suit_t from_canon[SUIT_SPADE + 1];  // canonical suit -> original suit
+} canon_t;
+
+void canon_mask(canon_t *canon, handmask_t hand, card_t starter);
+void canon_hand(canon_t *canon, hand_t *hand);
+uint32_t canon_count(int ncards, bool starter);
+
+/* Map a card of the original hand to the canonical hand. */
+static inline card_t canon_card(canon_t *canon, card_t card) {
+    return (card_t) {suit: canon->to_canon[card.suit], rank: card.rank};
+}
+
+/* Map a card of the canonical hand back to the original hand. */
+static inline card_t canon_uncard(canon_t *canon, card_t card) {
+    return (card_t) {suit: canon->from_canon[card.suit], rank: card.rank};
+}
+
+#endif
@@ -1,10 +1,12 @@
 #include <assert.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "alloc.h"
 #include "cards.h"
-#include "log.h"
+#include "logging.h"
 #include "stringbuilder.h"
 
 /* Map member of the rank_t enum to the value of that card when
@@ -66,9 +68,7 @@ char *card_str(char result[], card_t card) {
 }
 
 int card_cmp(card_t *card_a, card_t *card_b) {
-    unsigned char val_a = *((unsigned char *) (card_a));
-    unsigned char val_b = *((unsigned char *) (card_b));
-    return val_a - val_b;
+    return card_code(*card_a) - card_code(*card_b);
 }
 
 char *cards_str(char buf[], size_t size, int ncards, card_t cards[]) {
@@ -94,15 +94,18 @@ char *cards_str(char buf[], size_t size, int ncards, card_t cards[]) {
 }
 
 void log_cards(int level, char *prefix, int ncards, card_t cards[]) {
+    if (!log_enabled(level)) {
+        return;
+    }
     size_t bufsize = 5 * ncards;
     char buf[bufsize];
 
     cards_str(buf, bufsize, ncards, cards);
     if (prefix == NULL) {
-        log_log(level, __FILE__, __LINE__, buf);
+        log_at(level, "%s", buf);
     }
     else {
-        log_log(level, __FILE__, __LINE__, "%s: %s", prefix, buf);
+        log_at(level, "%s: %s", prefix, buf);
     }
 }
 
@@ -110,47 +113,152 @@ static int cmp_cards(const void *a, const void *b) {
     return card_cmp((card_t *) a,  (card_t *) b);
 }
 
-/* Sort an array of cards in place (by rank then suit). */
+/* Compare-exchange two card codes without branching: afterwards,
+ * codes[i] <= codes[j].
+ */
+static inline void cswap(uint8_t codes[], int i, int j) {
+    uint8_t a = codes[i];
+    uint8_t b = codes[j];
+    codes[i] = a < b ? a : b;
+    codes[j] = a < b ? b : a;
+}
+
+// Sorting networks for 2 .. 7 elements, with the minimum known number of
+// comparators for each size (1, 3, 5, 9, 12, 16).
+static inline void sort_network(int ncards, uint8_t c[]) {
+    switch (ncards) {
+    case 2:
+        cswap(c, 0, 1);
+        break;
+    case 3:
+        cswap(c, 0, 2); cswap(c, 0, 1); cswap(c, 1, 2);
+        break;
+    case 4:
+        cswap(c, 0, 1); cswap(c, 2, 3);
+        cswap(c, 0, 2); cswap(c, 1, 3);
+        cswap(c, 1, 2);
+        break;
+    case 5:
+        cswap(c, 0, 3); cswap(c, 1, 4);
+        cswap(c, 0, 2); cswap(c, 1, 3);
+        cswap(c, 0, 1); cswap(c, 2, 4);
+        cswap(c, 1, 2); cswap(c, 3, 4);
+        cswap(c, 2, 3);
+        break;
+    case 6:
+        cswap(c, 0, 5); cswap(c, 1, 3); cswap(c, 2, 4);
+        cswap(c, 1, 2); cswap(c, 3, 4);
+        cswap(c, 0, 3); cswap(c, 2, 5);
+        cswap(c, 0, 1); cswap(c, 2, 3); cswap(c, 4, 5);
+        cswap(c, 1, 2); cswap(c, 3, 4);
+        break;
+    case 7:
+        cswap(c, 0, 6); cswap(c, 2, 3); cswap(c, 4, 5);
+        cswap(c, 0, 2); cswap(c, 1, 4); cswap(c, 3, 6);
+        cswap(c, 0, 1); cswap(c, 2, 5); cswap(c, 3, 4);
+        cswap(c, 1, 2); cswap(c, 4, 6);
+        cswap(c, 2, 3); cswap(c, 4, 5);
+        cswap(c, 1, 2); cswap(c, 3, 4); cswap(c, 5, 6);
+        break;
+    }
+}
+
+/* Sort an array of cards in place (by rank then suit). Arrays of up to 7
+ * cards -- i.e. everything cribbage needs -- go through a sorting network;
+ * anything bigger falls back to qsort().
+ */
 void sort_cards(int ncards, card_t cards[]) {
-    qsort(cards, ncards, sizeof(card_t), cmp_cards);
+    if (ncards > 7) {
+        qsort(cards, ncards, sizeof(card_t), cmp_cards);
+        return;
+    }
+
+    uint8_t codes[7];
+    for (int i = 0; i < ncards; i++) {
+        codes[i] = card_code(cards[i]);
+    }
+    sort_network(ncards, codes);
+    for (int i = 0; i < ncards; i++) {
+        cards[i] = card_from_code(codes[i]);
+    }
 }
 
 /* allocate and populate a new deck with the standard 52 cards, sorted */
 deck_t *new_deck() {
     // sanity check to ensure I understand struct layout
-    assert(sizeof(card_t) == sizeof(uint));
+    assert(sizeof(card_t) == 1);
 
     int ncards = 52;
-    deck_t *deck = malloc(sizeof(deck_t) + (ncards * sizeof(card_t)));
+    deck_t *deck = alloc_malloc(sizeof(deck_t) + (ncards * sizeof(card_t)));
     deck->ncards = ncards;
-    int i = 0;
-    for (int rank = RANK_ACE; rank <= RANK_KING; rank++) {
-        for (int suit = SUIT_CLUB; suit <= SUIT_SPADE; suit++) {
-            deck->cards[i].rank = rank;
-            deck->cards[i].suit = suit;
-            i++;
-        }
-    }
+    reset_deck(deck);
     return deck;
 }
 
-/* shuffle an existing deck in place */
-void shuffle_deck(deck_t *deck) {
-    card_t tmp;
+/* put the cards of an existing deck back in sorted order, so the next
+ * shuffle does not depend on how the deck was used before
+ */
+void reset_deck(deck_t *deck) {
+    assert(deck->ncards == 52);
     for (int i = 0; i < deck->ncards; i++) {
-        int j = rand() % deck->ncards;
+        deck->cards[i] = card_from_index(i);
+    }
+}
+
+/* shuffle an existing deck in place (Fisher-Yates) */
+void shuffle_deck(deck_t *deck, rng_t *rng) {
+    card_t tmp;
+    for (int i = deck->ncards - 1; i > 0; i--) {
+        int j = rng_below(rng, i + 1);
+        tmp = deck->cards[i];
+        deck->cards[i] = deck->cards[j];
+        deck->cards[j] = tmp;
+    }
+}
+
+/* Draw ncards random cards from deck into dest, without replacement.
+ * This is a partial Fisher-Yates shuffle: it only does the work for the
+ * cards actually drawn, and then undoes its swaps so that deck is left
+ * exactly as it was. The cards drawn thus depend only on the order of
+ * deck and on rng.
+ */
+void deal_cards(deck_t *deck, rng_t *rng, int ncards, card_t dest[]) {
+    assert(ncards <= deck->ncards && deck->ncards <= 52);
+    uint8_t swapped[52];
+    card_t tmp;
+    for (int i = 0; i < ncards; i++) {
+        int j = i + rng_below(rng, deck->ncards - i);
+        swapped[i] = j;
+        tmp = deck->cards[i];
+        deck->cards[i] = deck->cards[j];
+        deck->cards[j] = tmp;
+        dest[i] = deck->cards[i];
+    }
+    for (int i = ncards - 1; i >= 0; i--) {
+        int j = swapped[i];
         tmp = deck->cards[i];
         deck->cards[i] = deck->cards[j];
         deck->cards[j] = tmp;
     }
 }
 
+/* Fill deals[0 .. ndeals-1] with consecutive random deals from deck. */
+void deal_batch(deck_t *deck, rng_t *rng, size_t ndeals, deal_t deals[]) {
+    for (size_t i = 0; i < ndeals; i++) {
+        deal_cards(deck, rng, DEAL_NCARDS, deals[i].cards);
+    }
+}
+
+/* Make hand an empty hand of the requested size */
+void hand_init(hand_t *hand, int size) {
+    assert(size >= 0 && size <= HAND_MAX_CARDS);
+    *hand = (hand_t) {size: size, ncards: 0, starter: -1};
+}
+
 /* Allocate an empty hand of the requested size */
 hand_t *new_hand(int size) {
-    int nbytes = sizeof(hand_t) + (size * sizeof(card_t));
-    hand_t *hand = calloc(1, nbytes);
-    hand->size = size;
-    hand->starter = -1;
+    hand_t *hand = alloc_malloc(sizeof(hand_t));
+    hand_init(hand, size);
     return hand;
 }
 
@@ -164,6 +272,21 @@ void hand_append(hand_t *dest, card_t card) {
     dest->ncards++;
 }
 
+/* Insert card into a sorted hand, keeping it sorted. Return the index
+ * of the new card.
+ */
+int hand_insert_sorted(hand_t *dest, card_t card) {
+    assert(dest->ncards < dest->size);
+    uint8_t code = card_code(card);
+    int i;
+    for (i = dest->ncards; i > 0 && card_code(dest->cards[i-1]) > code; i--) {
+        dest->cards[i] = dest->cards[i-1];
+    }
+    dest->cards[i] = card;
+    dest->ncards++;
+    return i;
+}
+
 void hand_truncate(hand_t *dest) {
     dest->ncards = 0;
     memset(dest->cards, 0, sizeof(card_t) * dest->size);
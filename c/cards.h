@@ -1,6 +1,11 @@
 #ifndef _CARDS_H
 #define _CARDS_H
 
+#include <stddef.h>
+#include <stdint.h>
+
+#include "rng.h"
+
 typedef unsigned int uint;
 
 typedef enum {
@@ -28,16 +33,29 @@ typedef enum {
     RANK_KING,
 } rank_t;
 
+// A card is a single byte: suit in the low nibble, rank in the high nibble.
+// Cards are thus ordered by rank then suit when compared as bytes (see
+// card_code()), a 6-card hand is 6 bytes, and a deal is 13 bytes.
 typedef struct {
-    suit_t suit:4;
-    rank_t rank:4;
+    uint8_t suit:4;           // suit_t
+    uint8_t rank:4;           // rank_t
 } card_t;
 
+// Stands for "no card" (e.g. no starter): the all-zero card.
+#define CARD_NONE ((card_t) {suit: SUIT_NONE, rank: RANK_JOKER})
+
+// No hand ever holds more cards than this: the most is the 8 cards played
+// in one round of pegging.
+#define HAND_MAX_CARDS 8
+
+// A hand is a value: its cards are inline, so it can live on the stack or
+// inside another struct, and be copied by assignment. size is the capacity
+// it was set up with (by hand_init() or new_hand()), at most HAND_MAX_CARDS.
 typedef struct {
-    uint size;                // number of entries allocated for the array
-    uint ncards;              // number of entries actually used
-    int starter;              // index of the starter card in cards (-1 if none)
-    card_t cards[];
+    uint8_t size;             // capacity: number of cards it may hold
+    uint8_t ncards;           // number of entries actually used
+    int8_t starter;           // index of the starter card in cards (-1 if none)
+    card_t cards[HAND_MAX_CARDS];
 } hand_t;
 
 typedef struct {
@@ -45,23 +63,58 @@ typedef struct {
     card_t cards[];
 } deck_t;
 
+// A deal is every card that one hand of two-player cribbage takes from
+// the deck: six cards for each player, plus the starter card.
+#define DEAL_HAND_CARDS 6
+#define DEAL_NCARDS (2 * DEAL_HAND_CARDS + 1)
+#define DEAL_STARTER (DEAL_NCARDS - 1)
+
+typedef struct {
+    card_t cards[DEAL_NCARDS];  // player 0, then player 1, then starter
+} deal_t;
+
 extern uint rank_value[14];
 
+/* Return card as a single byte that orders cards by rank, then suit. */
+static inline uint8_t card_code(card_t card) {
+    return (card.rank << 4) | card.suit;
+}
+
+/* Inverse of card_code(). */
+static inline card_t card_from_code(uint8_t code) {
+    return (card_t) {suit: code & 0xf, rank: code >> 4};
+}
+
+/* Return the position of card in a sorted deck: 0 (A♣) .. 51 (K♠). */
+static inline int card_index(card_t card) {
+    return (card.rank - RANK_ACE) * 4 + (card.suit - SUIT_CLUB);
+}
+
+/* Inverse of card_index(). */
+static inline card_t card_from_index(int index) {
+    return (card_t) {suit: SUIT_CLUB + index % 4, rank: RANK_ACE + index / 4};
+}
+
 char *card_debug(char result[], card_t card);
 char *card_str(char result[], card_t card);
 int card_cmp(card_t *, card_t *);
 void log_cards(int level, char *prefix, int ncards, card_t cards[]);
 void sort_cards(int ncards, card_t cards[]);
 
-hand_t *new_hand(int ncards);
+void hand_init(hand_t *hand, int size);
+hand_t *new_hand(int size);
 char *hand_str(char *buf, size_t size, hand_t *hand);
 void hand_append(hand_t *dest, card_t card);
+int hand_insert_sorted(hand_t *dest, card_t card);
 void hand_truncate(hand_t *dest);
 void hand_delete(hand_t *dest, int del_idx);
 void copy_hand(hand_t *dest, hand_t *src);
 void hand_set_card(hand_t *hand, int idx, rank_t rank, suit_t suit);
 
 deck_t *new_deck();
-void shuffle_deck(deck_t *deck);
+void reset_deck(deck_t *deck);
+void shuffle_deck(deck_t *deck, rng_t *rng);
+void deal_cards(deck_t *deck, rng_t *rng, int ncards, card_t dest[]);
+void deal_batch(deck_t *deck, rng_t *rng, size_t ndeals, deal_t deals[]);
 
 #endif
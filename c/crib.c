@@ -0,0 +1,91 @@
+#define _POSIX_C_SOURCE 200809L    // for mmap(), fstat()
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "crib.h"
+#include "logging.h"
+
+// The table that crib_value() consults, if any. Set once at startup and
+// only read after that, so threads can share it freely.
+static const crib_table_t *current_table = NULL;
+
+/* Map the crib table stored in path, and check that it really is a crib
+ * table of the current version. Returns NULL (after logging why) if not.
+ * The mapping is read-only and lasts for the life of the process.
+ */
+const crib_table_t *crib_table_load(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        log_error("%s: cannot open crib table: %s", path, strerror(errno));
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size != sizeof(crib_table_t)) {
+        log_error("%s: not a crib table: expected %zu bytes",
+                  path,
+                  sizeof(crib_table_t));
+        close(fd);
+        return NULL;
+    }
+
+    void *addr = mmap(NULL, sizeof(crib_table_t), PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        log_error("%s: cannot map crib table: %s", path, strerror(errno));
+        return NULL;
+    }
+
+    const crib_table_t *table = addr;
+    if (memcmp(table->magic, CRIB_TABLE_MAGIC, sizeof(table->magic)) != 0 ||
+        table->version != CRIB_TABLE_VERSION) {
+        log_error("%s: not a crib table (or wrong version)", path);
+        munmap(addr, sizeof(crib_table_t));
+        return NULL;
+    }
+
+    log_debug("%s: loaded crib table (%d passes of %lu deals)",
+              path,
+              table->iterations,
+              (unsigned long) table->ndeals);
+    return table;
+}
+
+/* Write table to path. Returns false (after logging why) on failure. */
+bool crib_table_write(const char *path, const crib_table_t *table) {
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        log_error("%s: cannot create crib table: %s", path, strerror(errno));
+        return false;
+    }
+    bool ok = fwrite(table, sizeof(crib_table_t), 1, file) == 1;
+    ok = (fclose(file) == 0) && ok;
+    if (!ok) {
+        log_error("%s: error writing crib table", path);
+    }
+    return ok;
+}
+
+/* Make crib_value() look up values in table (or return 0 for everything,
+ * if table is NULL).
+ */
+void crib_table_use(const crib_table_t *table) {
+    current_table = table;
+}
+
+/* Return the expected score of a crib that card1 and card2 are discarded
+ * into. dealer is true for the dealer's own crib.
+ */
+float crib_value(card_t card1, card_t card2, bool dealer) {
+    if (current_table == NULL) {
+        return 0;
+    }
+    bool suited = card1.rank != card2.rank && card1.suit == card2.suit;
+    return current_table->value[dealer][card1.rank][card2.rank][suited];
+}
@@ -0,0 +1,39 @@
+#ifndef _CRIB_H
+#define _CRIB_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "cards.h"
+
+// A crib table holds the expected score of a crib, given two of the cards
+// that went into it: one value per rank pair and suited/unsuited, for the
+// dealer's crib and for the pone's crib (the same cards are worth different
+// amounts in each, because the opponent discards differently). The values
+// are averaged over opponent discards and starters by an offline
+// simulation (see c/tools/gen_crib_table.c).
+//
+// Tables are stored on disk exactly as this struct, in native byte order,
+// so loading one is just mapping the file.
+#define CRIB_TABLE_MAGIC "cribtbl"
+#define CRIB_TABLE_VERSION 1
+
+typedef struct {
+    char magic[8];              // CRIB_TABLE_MAGIC, NUL-terminated
+    uint32_t version;           // CRIB_TABLE_VERSION
+    uint32_t iterations;        // simulation passes used to build the table
+    uint64_t ndeals;            // deals simulated per pass and role
+
+    // Expected crib score by [dealer][rank 1][rank 2][suited]. Symmetric in
+    // the two ranks; entries for two cards of the same rank are always
+    // unsuited.
+    float value[2][RANK_KING + 1][RANK_KING + 1][2];
+} crib_table_t;
+
+const crib_table_t *crib_table_load(const char *path);
+bool crib_table_write(const char *path, const crib_table_t *table);
+void crib_table_use(const crib_table_t *table);
+
+float crib_value(card_t card1, card_t card2, bool dealer);
+
+#endif
@@ -1,35 +1,252 @@
+#define _POSIX_C_SOURCE 200809L    // for getopt(), pthreads
+
+#include <inttypes.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
 #include <sys/types.h>
 
+#include "alloc.h"
 #include "cards.h"
-#include "log.h"
+#include "crib.h"
+#include "discard_cache.h"
+#include "discard_table.h"
+#include "logging.h"
+#include "phase_timing.h"
 #include "play.h"
+#include "rng.h"
+
+/* Per-thread state for the game runner: every worker has its own deck,
+ * its own RNG state, and its own win counters, so workers never touch
+ * shared state while playing.
+ */
+typedef struct {
+    pthread_t thread;
+    int id;
+    int nworkers;
+    int first_game;
+    int ngames;                 // total games in the run (not per worker)
+    uint64_t seed;
+    strategy_t *strategy;       // shared, read-only
+    deck_t *deck;
+    rng_t rng;
+    int games_won[2];
+} worker_t;
+
+/* Play games first_game + id, first_game + id + nworkers, ... Every game
+ * gets its own RNG stream keyed by (seed, game index), so the outcome of
+ * game N does not depend on which worker plays it or on what else that
+ * worker played before it.
+ */
+static void *run_worker(void *arg) {
+    worker_t *worker = arg;
+    int end = worker->first_game + worker->ngames;
+    async_log_thread(worker->id);
+    for (int gidx = worker->first_game + worker->id; gidx < end; gidx += worker->nworkers) {
+        async_log_game(gidx);
+        rng_init(&worker->rng, worker->seed, (uint64_t) gidx);
+        playername_t winner = play_game(worker->strategy, worker->deck, &worker->rng);
+        worker->games_won[winner]++;
+    }
+    return NULL;
+}
+
+static void lock_log(bool lock, void *udata) {
+    pthread_mutex_t *mutex = udata;
+    if (lock) {
+        pthread_mutex_lock(mutex);
+    }
+    else {
+        pthread_mutex_unlock(mutex);
+    }
+}
+
+static void usage(char *prog) {
+    fprintf(stderr,
+            "usage: %s [-v] [-n ngames] [-j nthreads] [-s seed] [-g game]"
+            " [-a discard] [-b discard] [-A peg] [-B peg] [-c crib-table]"
+            " [-t discard-table] [-m cache-mb]\n"
+            "discard strategies: simple, random, expected, crib, table (needs -t)\n"
+            "pegging strategies: low, high, greedy, mc, solver (sees both hands)\n",
+            prog);
+    exit(2);
+}
 
 int main(int argc, char *argv[]) {
-    log_set_level(LOG_INFO);
+    int log_level = LOG_INFO;
 
     time_t now = time(NULL);
     pid_t pid = getpid();
-    uint seed = (int) now ^ (int) pid ^ ((int) pid << 16);
-    log_trace("now = %ld, pid = %d, seed = %ud", now, pid, seed);
-    srand(seed);
-
+    uint64_t seed = (uint) ((int) now ^ (int) pid ^ ((int) pid << 16));
+    int first_game = 0;
     int ngames = 100;
-    int games_won[2] = {0, 0};
-    deck_t *deck = new_deck();
+    int nthreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+
+    // Both players peg naively unless told otherwise; the discard and
+    // pegging strategies for each player can be picked with -a, -b, -A
+    // and -B.
+    strategy_t strategy[2] = {
+        (strategy_t) {peg_func: peg_select_low, discard_func: discard_simple},
+        (strategy_t) {peg_func: peg_select_low, discard_func: discard_simple},
+    };
+    const crib_table_t *crib_table = NULL;
+    discard_table_t *discard_tbl = NULL;
+    int cache_mb = 0;
 
-    for (int gidx = 0; gidx < ngames; gidx++) {
-        playername_t winner = play_game(deck);
-        games_won[winner]++;
+    int opt;
+    while ((opt = getopt(argc, argv, "vn:j:s:g:a:b:A:B:c:t:m:")) != -1) {
+        switch (opt) {
+        case 'v':
+            if (log_level > LOG_TRACE) {
+                log_level--;
+            }
+            break;
+        case 'n':
+            ngames = atoi(optarg);
+            break;
+        case 'j':
+            nthreads = atoi(optarg);
+            break;
+        case 's':
+            seed = strtoull(optarg, NULL, 0);
+            break;
+        case 'g':
+            // Replay just one game of the run.
+            first_game = atoi(optarg);
+            ngames = 1;
+            break;
+        case 'a':
+        case 'b':
+            if (strcmp(optarg, "table") == 0) {
+                // Needs the table from -t: see below.
+                strategy[opt - 'a'].discard_func = discard_table;
+                break;
+            }
+            strategy[opt - 'a'].discard_func = discard_func_by_name(optarg);
+            if (strategy[opt - 'a'].discard_func == NULL) {
+                fprintf(stderr, "unknown discard strategy: %s\n", optarg);
+                usage(argv[0]);
+            }
+            break;
+        case 'A':
+        case 'B':
+            strategy[opt - 'A'].peg_func = peg_func_by_name(optarg);
+            if (strategy[opt - 'A'].peg_func == NULL) {
+                fprintf(stderr, "unknown pegging strategy: %s\n", optarg);
+                usage(argv[0]);
+            }
+            break;
+        case 'c':
+            crib_table = crib_table_load(optarg);
+            if (crib_table == NULL) {
+                exit(1);
+            }
+            break;
+        case 't':
+            discard_tbl = discard_table_load(optarg);
+            if (discard_tbl == NULL) {
+                exit(1);
+            }
+            break;
+        case 'm':
+            // Remember each player's discard decisions, in at most this
+            // many MB per player.
+            cache_mb = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+        }
     }
-    log_info("player a: %d wins, player b: %d wins",
+    if (optind < argc || ngames < 0 || first_game < 0) {
+        usage(argv[0]);
+    }
+    if (nthreads < 1) {
+        nthreads = 1;
+    }
+    for (int p = 0; p < 2; p++) {
+        if (strategy[p].discard_func == discard_table) {
+            if (discard_tbl == NULL) {
+                fprintf(stderr, "discard strategy 'table' needs a table (-t)\n");
+                usage(argv[0]);
+            }
+            strategy[p].discard_data = discard_tbl;
+        }
+    }
+    logging_set_level(log_level);
+    crib_table_use(crib_table);
+    log_trace("now = %ld, pid = %d, seed = %" PRIu64, now, pid, seed);
+
+    discard_cache_t *caches[2] = {NULL, NULL};
+    if (cache_mb > 0) {
+        for (int p = 0; p < 2; p++) {
+            caches[p] = discard_cache_wrap(&strategy[p], (size_t) cache_mb << 20);
+            if (caches[p] == NULL) {
+                log_info("player %c: not caching discard strategy (not known to be deterministic)",
+                         'a' + p);
+            }
+        }
+    }
+
+    // Workers log through per-thread buffers, so they never wait for each
+    // other (or for stderr); the mutex covers anything logged directly.
+    pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
+    log_set_lock(lock_log, &log_mutex);
+    async_log_start(stderr, 256 << 10);
+
+    worker_t workers[nthreads];
+    for (int i = 0; i < nthreads; i++) {
+        workers[i] = (worker_t) {
+            id: i,
+            nworkers: nthreads,
+            first_game: first_game,
+            ngames: ngames,
+            seed: seed,
+            strategy: strategy,
+            deck: new_deck(),
+            games_won: {0, 0},
+        };
+        if (pthread_create(&workers[i].thread, NULL, run_worker, &workers[i]) != 0) {
+            log_fatal("pthread_create() failed for worker %d", i);
+            exit(1);
+        }
+    }
+
+    // Merge per-worker results. Every game has its own RNG stream, so the
+    // totals are the same no matter how many workers we use.
+    int games_won[2] = {0, 0};
+    for (int i = 0; i < nthreads; i++) {
+        pthread_join(workers[i].thread, NULL);
+        games_won[PLAYER_A] += workers[i].games_won[PLAYER_A];
+        games_won[PLAYER_B] += workers[i].games_won[PLAYER_B];
+        alloc_free(workers[i].deck);
+    }
+    async_log_stop();
+    log_set_lock(NULL, NULL);
+
+    log_info("seed %" PRIu64 ": player a: %d wins, player b: %d wins",
+             seed,
              games_won[PLAYER_A],
              games_won[PLAYER_B]);
+    for (int p = 0; p < 2; p++) {
+        if (caches[p] != NULL) {
+            uint64_t hits, misses;
+            discard_cache_stats(caches[p], &hits, &misses);
+            log_info("player %c discard cache: %" PRIu64 " hits, %" PRIu64 " misses",
+                     'a' + p,
+                     hits,
+                     misses);
+            discard_cache_free(caches[p]);
+        }
+    }
+    if (discard_tbl != NULL) {
+        discard_table_free(discard_tbl);
+    }
+    phase_timing_report();
+    alloc_profile_report();
 
-    free(deck);
     return 0;
 }
@@ -0,0 +1,153 @@
+#include <assert.h>
+#include <stdlib.h>
+
+#include "alloc.h"
+#include "canon.h"
+#include "discard_cache.h"
+#include "handmask.h"
+#include "logging.h"
+
+// Every (canonical 6-card hand, dealer flag) pair has a key. An entry holds
+// key + 1 (so that 0 is an empty entry), and the positions of the two
+// cards to discard in the sorted canonical hand:
+//
+//   bits 0-2: position of first discard
+//   bits 3-5: position of second discard
+//   bits 6- : key + 1
+#define ENTRY_KEY_SHIFT 6
+
+// The slot in every cache's counts that this thread counts in, claimed on
+// its first lookup. Past DISCARD_CACHE_MAX_THREADS threads, slots are
+// shared, which costs some contention but loses no counts.
+static int nthreads = 0;
+static __thread int thread_slot = -1;
+
+/* Create a cache for decisions of func (with discard_data data), using
+ * at most budget bytes (but at least 4 kB). func must be deterministic.
+ * There is no point in giving it more than 8 MB: that is enough for a
+ * separate entry for every hand.
+ */
+discard_cache_t *new_discard_cache(discard_func_t func, void *data, size_t budget) {
+    assert(discard_func_deterministic(func));
+    uint32_t nkeys = 2 * canon_count(DEAL_HAND_CARDS, false);
+    int bits = 10;
+    while ((1UL << bits) < nkeys &&
+           (sizeof(uint32_t) << (bits + 1)) <= budget) {
+        bits++;
+    }
+
+    discard_cache_t *cache = alloc_calloc(1, sizeof(discard_cache_t));
+    cache->func = func;
+    cache->data = data;
+    cache->entries = alloc_calloc(1UL << bits, sizeof(uint32_t));
+    cache->mask = (1UL << bits) - 1;
+    cache->shift = ((1UL << bits) >= nkeys) ? 0 : 32 - bits;
+    cache->counts = alloc_calloc(DISCARD_CACHE_MAX_THREADS, sizeof(discard_cache_counts_t));
+    log_debug("discard cache: %lu entries for %u keys",
+              (unsigned long) cache->mask + 1,
+              nkeys);
+    return cache;
+}
+
+void discard_cache_free(discard_cache_t *cache) {
+    alloc_free(cache->counts);
+    alloc_free(cache->entries);
+    alloc_free(cache);
+}
+
+/* Make strategy discard through a new cache of at most budget bytes, and
+ * return the cache. Returns NULL, leaving strategy alone, if its discard
+ * strategy is not deterministic (and so must not be cached).
+ */
+discard_cache_t *discard_cache_wrap(strategy_t *strategy, size_t budget) {
+    if (!discard_func_deterministic(strategy->discard_func)) {
+        return NULL;
+    }
+    discard_cache_t *cache = new_discard_cache(strategy->discard_func,
+                                               strategy->discard_data,
+                                               budget);
+    strategy->discard_func = discard_cached;
+    strategy->discard_data = cache;
+    return cache;
+}
+
+/* Add up the hits and misses of every thread so far. */
+void discard_cache_stats(discard_cache_t *cache, uint64_t *hits, uint64_t *misses) {
+    *hits = 0;
+    *misses = 0;
+    for (int i = 0; i < DISCARD_CACHE_MAX_THREADS; i++) {
+        *hits += __atomic_load_n(&cache->counts[i].hits, __ATOMIC_RELAXED);
+        *misses += __atomic_load_n(&cache->counts[i].misses, __ATOMIC_RELAXED);
+    }
+}
+
+/* Ask the cached strategy what to discard from the sorted canonical hand
+ * (as a set of cards), and return the resulting cache entry.
+ */
+static uint32_t discard_miss(discard_cache_t *cache,
+                             handmask_t canon_hand,
+                             uint32_t key,
+                             discard_ctx_t *ctx) {
+    hand_t hand_buf, crib_buf;
+    hand_t *hand = &hand_buf;
+    hand_t *crib = &crib_buf;
+    hand_init(hand, DEAL_HAND_CARDS);
+    hand_init(crib, 2);
+    handmask_to_hand(hand, canon_hand);
+
+    discard_ctx_t inner = {dealer: ctx->dealer, rng: ctx->rng, data: cache->data};
+    cache->func(hand, crib, &inner);
+    assert(hand->ncards == DEAL_HAND_CARDS - 2);
+    assert(crib->ncards == 2);
+
+    // Find the discards' positions in the sorted hand.
+    handmask_to_hand(hand, canon_hand);
+    uint32_t entry = (key + 1) << ENTRY_KEY_SHIFT;
+    int shift = 0;
+    for (int i = 0; i < hand->ncards; i++) {
+        if (card_cmp(&hand->cards[i], &crib->cards[0]) == 0 ||
+            card_cmp(&hand->cards[i], &crib->cards[1]) == 0) {
+            entry |= i << shift;
+            shift += 3;
+        }
+    }
+    assert(shift == 6);
+    return entry;
+}
+
+/* Discard strategy: look up the decision of the strategy wrapped by the
+ * discard_cache_t in ctx->data, asking that strategy on a cache miss.
+ * Requires a sorted 6-card hand.
+ */
+void discard_cached(hand_t *hand, hand_t *crib, discard_ctx_t *ctx) {
+    discard_cache_t *cache = ctx->data;
+    assert(hand->ncards == DEAL_HAND_CARDS);
+
+    canon_t canon;
+    canon_mask(&canon, hand_mask(hand), (card_t) {suit: SUIT_NONE, rank: RANK_JOKER});
+    uint32_t key = canon.index * 2 + ctx->dealer;
+    uint32_t slot = (cache->shift == 0) ? key : (key * 0x9e3779b1u) >> cache->shift;
+
+    if (thread_slot < 0) {
+        thread_slot = __atomic_fetch_add(&nthreads, 1, __ATOMIC_RELAXED) % DISCARD_CACHE_MAX_THREADS;
+    }
+    discard_cache_counts_t *counts = &cache->counts[thread_slot];
+
+    uint32_t entry = __atomic_load_n(&cache->entries[slot], __ATOMIC_RELAXED);
+    if (entry >> ENTRY_KEY_SHIFT == key + 1) {
+        __atomic_fetch_add(&counts->hits, 1, __ATOMIC_RELAXED);
+    }
+    else {
+        __atomic_fetch_add(&counts->misses, 1, __ATOMIC_RELAXED);
+        entry = discard_miss(cache, canon.hand, key, ctx);
+        __atomic_store_n(&cache->entries[slot], entry, __ATOMIC_RELAXED);
+    }
+
+    // Map the discards from the canonical hand back to this one.
+    card_t discards[2] = {
+        canon_uncard(&canon, handmask_nth(canon.hand, entry & 7)),
+        canon_uncard(&canon, handmask_nth(canon.hand, (entry >> 3) & 7)),
+    };
+    discard_cards(hand, crib, discards);
+    assert(hand->ncards == DEAL_HAND_CARDS - 2);
+}
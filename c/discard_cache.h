@@ -0,0 +1,52 @@
+#ifndef _DISCARD_CACHE_H
+#define _DISCARD_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "play.h"
+
+// A discard cache remembers the decisions of another discard strategy, by
+// suit-canonical 6-card hand and dealer flag. Decisions are always made on
+// the canonical hand and mapped back to the real suits, so a cached
+// strategy makes the same decision for a hand whether it hits the cache
+// or not (and thus whatever the cache size or thread count).
+//
+// That only holds for deterministic strategies (see
+// discard_func_deterministic()): a random one would have its first choice
+// for a hand replayed ever after, and would draw from the game's RNG on
+// misses but not on hits, so games would depend on which games came
+// before them. discard_cache_wrap() leaves those uncached.
+//
+// To use one, set strategy.discard_func to discard_cached and
+// strategy.discard_data to the cache (or let discard_cache_wrap() do it).
+// One cache can be shared by every worker thread: lookups never lock, and
+// a decision is a single word, so a reader sees either the old or the new
+// entry. Each thread counts its hits and misses on a cache line of its
+// own; discard_cache_stats() adds them up.
+#define DISCARD_CACHE_MAX_THREADS 64
+
+// The counts are allocated with no more than malloc() alignment, so each
+// slot spans two cache lines: then no two slots' counters share one.
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    char pad[112];
+} discard_cache_counts_t;
+
+typedef struct {
+    discard_func_t func;        // the strategy being cached
+    void *data;                 // ... and its discard_data
+    uint32_t *entries;
+    uint32_t mask;              // number of entries - 1
+    int shift;                  // hash shift; 0 if every hand has its own entry
+    discard_cache_counts_t *counts;     // one per thread slot
+} discard_cache_t;
+
+discard_cache_t *new_discard_cache(discard_func_t func, void *data, size_t budget);
+void discard_cache_free(discard_cache_t *cache);
+discard_cache_t *discard_cache_wrap(strategy_t *strategy, size_t budget);
+void discard_cache_stats(discard_cache_t *cache, uint64_t *hits, uint64_t *misses);
+void discard_cached(hand_t *hand, hand_t *crib, discard_ctx_t *ctx);
+
+#endif
@@ -0,0 +1,160 @@
+#define _POSIX_C_SOURCE 200809L    // for mmap(), fstat()
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "alloc.h"
+#include "canon.h"
+#include "discard_table.h"
+#include "logging.h"
+
+static size_t table_size(uint32_t nclasses) {
+    return sizeof(discard_table_header_t)
+        + nclasses * sizeof(uint8_t[2])
+        + nclasses * sizeof(int16_t[2][DISCARD_OPTIONS]);
+}
+
+/* Point the arrays of table into the buffer that starts at its header. */
+static void table_layout(discard_table_t *table) {
+    char *base = (char *) table->header;
+    uint32_t nclasses = table->header->nclasses;
+    table->best = (void *) (base + sizeof(discard_table_header_t));
+    table->value = (void *) (base + sizeof(discard_table_header_t) + nclasses * sizeof(uint8_t[2]));
+}
+
+/* Create an empty discard table, to be filled by discard_table_fill(). */
+discard_table_t *new_discard_table(bool with_crib) {
+    uint32_t nclasses = canon_count(DEAL_HAND_CARDS, false);
+    discard_table_t *table = alloc_calloc(1, sizeof(discard_table_t));
+    table->size = table_size(nclasses);
+    table->header = alloc_calloc(1, table->size);
+    memcpy(table->header->magic, DISCARD_TABLE_MAGIC, sizeof(table->header->magic));
+    table->header->version = DISCARD_TABLE_VERSION;
+    table->header->nclasses = nclasses;
+    table->header->with_crib = with_crib;
+    table_layout(table);
+    return table;
+}
+
+/* Map the discard table stored in path, and check that it really is a
+ * discard table of the current version. Returns NULL (after logging why)
+ * if not.
+ */
+discard_table_t *discard_table_load(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        log_error("%s: cannot open discard table: %s", path, strerror(errno));
+        return NULL;
+    }
+
+    uint32_t nclasses = canon_count(DEAL_HAND_CARDS, false);
+    size_t size = table_size(nclasses);
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size != size) {
+        log_error("%s: not a discard table: expected %zu bytes", path, size);
+        close(fd);
+        return NULL;
+    }
+
+    void *addr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        log_error("%s: cannot map discard table: %s", path, strerror(errno));
+        return NULL;
+    }
+
+    discard_table_header_t *header = addr;
+    if (memcmp(header->magic, DISCARD_TABLE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != DISCARD_TABLE_VERSION ||
+        header->nclasses != nclasses) {
+        log_error("%s: not a discard table (or wrong version)", path);
+        munmap(addr, size);
+        return NULL;
+    }
+
+    discard_table_t *table = alloc_calloc(1, sizeof(discard_table_t));
+    table->header = header;
+    table->size = size;
+    table->mapped = true;
+    table_layout(table);
+    log_debug("%s: loaded discard table (%u classes, with_crib=%u)",
+              path,
+              header->nclasses,
+              header->with_crib);
+    return table;
+}
+
+/* Write table to path. Returns false (after logging why) on failure. */
+bool discard_table_write(const char *path, discard_table_t *table) {
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        log_error("%s: cannot create discard table: %s", path, strerror(errno));
+        return false;
+    }
+    bool ok = fwrite(table->header, table->size, 1, file) == 1;
+    ok = (fclose(file) == 0) && ok;
+    if (!ok) {
+        log_error("%s: error writing discard table", path);
+    }
+    return ok;
+}
+
+void discard_table_free(discard_table_t *table) {
+    if (table->mapped) {
+        munmap(table->header, table->size);
+    }
+    else {
+        alloc_free(table->header);
+    }
+    alloc_free(table);
+}
+
+/* Compute the entries for hand, which must be a canonical 6-card hand.
+ * Values include crib_value() if the table was created with_crib, so the
+ * crib table to use must be set with crib_table_use() first.
+ */
+void discard_table_fill(discard_table_t *table, handmask_t hand) {
+    canon_t canon;
+    canon_mask(&canon, hand, (card_t) {suit: SUIT_NONE, rank: RANK_JOKER});
+    assert(canon.hand == hand);
+
+    hand_t sorted;
+    hand_init(&sorted, DEAL_HAND_CARDS);
+    handmask_to_hand(&sorted, hand);
+    for (int dealer = 0; dealer < 2; dealer++) {
+        float value[DISCARD_OPTIONS];
+        discard_values(&sorted, dealer, table->header->with_crib, value);
+        table->best[canon.index][dealer] = discard_best_option(value);
+        for (int option = 0; option < DISCARD_OPTIONS; option++) {
+            float scaled = value[option] * DISCARD_TABLE_SCALE;
+            table->value[canon.index][dealer][option] = scaled + (scaled < 0 ? -0.5f : 0.5f);
+        }
+    }
+}
+
+/* Discard strategy: play the best option according to the discard_table_t
+ * in ctx->data. Requires a 6-card hand.
+ */
+void discard_table(hand_t *hand, hand_t *crib, discard_ctx_t *ctx) {
+    discard_table_t *table = ctx->data;
+    assert(hand->ncards == DEAL_HAND_CARDS);
+
+    canon_t canon;
+    canon_mask(&canon, hand_mask(hand), (card_t) {suit: SUIT_NONE, rank: RANK_JOKER});
+    int best = table->best[canon.index][ctx->dealer];
+
+    // The options are positions in the sorted canonical hand: map them
+    // back to this hand's cards.
+    card_t discards[2] = {
+        canon_uncard(&canon, handmask_nth(canon.hand, discard_pairs[best][0])),
+        canon_uncard(&canon, handmask_nth(canon.hand, discard_pairs[best][1])),
+    };
+    discard_cards(hand, crib, discards);
+}
@@ -0,0 +1,49 @@
+#ifndef _DISCARD_TABLE_H
+#define _DISCARD_TABLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "handmask.h"
+#include "play.h"
+
+// A discard table holds the value of every discard option (in the order
+// of discard_pairs[]) for every suit-canonical 6-card hand, as dealer and
+// as pone, and the best option for each. It is built offline by
+// c/tools/gen_discard_table.c; playing from it (discard_table()) costs a
+// canonicalization and a lookup.
+//
+// On disk, a table is the header followed by the best[] and value[]
+// arrays, in native byte order, so loading it is just mapping the file.
+#define DISCARD_TABLE_MAGIC "discard"
+#define DISCARD_TABLE_VERSION 1
+
+// Values are stored in units of 1/DISCARD_TABLE_SCALE points.
+#define DISCARD_TABLE_SCALE 256
+
+typedef struct {
+    char magic[8];              // DISCARD_TABLE_MAGIC, NUL-terminated
+    uint32_t version;           // DISCARD_TABLE_VERSION
+    uint32_t nclasses;          // canon_count(6, false)
+    uint32_t with_crib;         // 1 if values include crib_value()
+    uint32_t reserved;
+} discard_table_header_t;
+
+typedef struct {
+    discard_table_header_t *header;
+    uint8_t (*best)[2];                         // [class][dealer]
+    int16_t (*value)[2][DISCARD_OPTIONS];       // [class][dealer][option]
+    size_t size;                                // of header + arrays
+    bool mapped;                                // from discard_table_load()
+} discard_table_t;
+
+discard_table_t *new_discard_table(bool with_crib);
+discard_table_t *discard_table_load(const char *path);
+bool discard_table_write(const char *path, discard_table_t *table);
+void discard_table_free(discard_table_t *table);
+void discard_table_fill(discard_table_t *table, handmask_t hand);
+
+void discard_table(hand_t *hand, hand_t *crib, discard_ctx_t *ctx);
+
+#endif
@@ -0,0 +1,31 @@
+#include <assert.h>
+
+#include "cards.h"
+#include "handmask.h"
+
+/* Return the set of all cards in hand (including the starter, if any). */
+handmask_t hand_mask(hand_t *hand) {
+    handmask_t mask = 0;
+    for (int i = 0; i < hand->ncards; i++) {
+        mask |= card_mask(hand->cards[i]);
+    }
+    return mask;
+}
+
+/* Replace the contents of dest with the cards in mask, sorted by rank
+ * then suit (the same order as sort_cards()).
+ */
+void handmask_to_hand(hand_t *dest, handmask_t mask) {
+    assert(handmask_count(mask) <= dest->size);
+    hand_truncate(dest);
+    dest->starter = -1;
+
+    // Gather each rank's bits from the four suit lanes.
+    for (int rank = 0; rank < 13; rank++) {
+        handmask_t bits = (mask >> rank) & 0x0001000100010001ULL;
+        for (; bits != 0; bits = handmask_rest(bits)) {
+            int suit = __builtin_ctzll(bits) / HANDMASK_LANE_BITS;
+            hand_append(dest, (card_t) {suit: SUIT_CLUB + suit, rank: RANK_ACE + rank});
+        }
+    }
+}
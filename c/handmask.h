@@ -0,0 +1,129 @@
+#ifndef _HANDMASK_H
+#define _HANDMASK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "cards.h"
+
+// handmask_t is a set of cards with one bit per card. Each suit gets a
+// 16-bit lane, with ranks ace .. king in bits 0 .. 12 of that lane:
+//
+//   bits  0-12: clubs     A 2 3 ... K
+//   bits 16-28: diamonds  A 2 3 ... K
+//   bits 32-44: hearts    A 2 3 ... K
+//   bits 48-60: spades    A 2 3 ... K
+//
+// So suit projections are a shift and a mask, rank projections are an OR
+// of four lanes, and set operations are single instructions.
+typedef uint64_t handmask_t;
+
+#define HANDMASK_LANE_BITS 16
+#define HANDMASK_RANKS 0x1fffULL                            // one full suit
+#define HANDMASK_DECK (HANDMASK_RANKS * 0x0001000100010001ULL)  // all 52 cards
+
+static inline int handmask_bit(card_t card) {
+    return (card.suit - SUIT_CLUB) * HANDMASK_LANE_BITS + (card.rank - RANK_ACE);
+}
+
+static inline card_t handmask_bit_card(int bit) {
+    return (card_t) {
+        suit: SUIT_CLUB + bit / HANDMASK_LANE_BITS,
+        rank: RANK_ACE + bit % HANDMASK_LANE_BITS,
+    };
+}
+
+static inline handmask_t card_mask(card_t card) {
+    return 1ULL << handmask_bit(card);
+}
+
+static inline int handmask_count(handmask_t mask) {
+    return __builtin_popcountll(mask);
+}
+
+static inline bool handmask_has(handmask_t mask, card_t card) {
+    return (mask & card_mask(card)) != 0;
+}
+
+static inline handmask_t handmask_union(handmask_t a, handmask_t b) {
+    return a | b;
+}
+
+static inline handmask_t handmask_remove(handmask_t mask, handmask_t remove) {
+    return mask & ~remove;
+}
+
+/* Return the lowest card in mask (by suit, then rank). mask must not be
+ * empty.
+ */
+static inline card_t handmask_first(handmask_t mask) {
+    return handmask_bit_card(__builtin_ctzll(mask));
+}
+
+/* Return mask without its lowest card: with handmask_first(), this
+ * iterates over a set of cards.
+ */
+static inline handmask_t handmask_rest(handmask_t mask) {
+    return mask & (mask - 1);
+}
+
+/* Return the set of ranks of the cards of one suit (bit 0 = ace). */
+static inline uint handmask_suit(handmask_t mask, suit_t suit) {
+    return (mask >> ((suit - SUIT_CLUB) * HANDMASK_LANE_BITS)) & HANDMASK_RANKS;
+}
+
+/* Return the set of ranks present in any suit (bit 0 = ace). */
+static inline uint handmask_ranks(handmask_t mask) {
+    mask |= mask >> 32;
+    mask |= mask >> 16;
+    return mask & HANDMASK_RANKS;
+}
+
+/* Return the points for a flush in hand (which must not include the
+ * starter card): every card in one suit lane, plus one if the starter
+ * is in that suit too. Same rules as count_flush().
+ */
+static inline uint handmask_flush(handmask_t hand, card_t starter) {
+    if (hand == 0) {
+        return 0;
+    }
+    int shift = __builtin_ctzll(hand) & ~(HANDMASK_LANE_BITS - 1);
+    if ((hand & ~(HANDMASK_RANKS << shift)) != 0) {
+        return 0;
+    }
+    uint points = handmask_count(hand);
+    if (starter.suit != SUIT_NONE && (starter.suit - SUIT_CLUB) * HANDMASK_LANE_BITS == shift) {
+        points++;
+    }
+    return points;
+}
+
+/* Return true if hand holds the jack of the starter's suit ("his nobs").
+ * Never true without a starter (suit SUIT_NONE).
+ */
+static inline bool handmask_nobs(handmask_t hand, card_t starter) {
+    if (starter.suit == SUIT_NONE) {
+        return false;
+    }
+    card_t jack = {suit: starter.suit, rank: RANK_JACK};
+    return (hand & card_mask(jack)) != 0;
+}
+
+/* Return card number n (counting from 0) of mask, in the order of
+ * handmask_to_hand(): by rank, then suit. mask must have more than n cards.
+ */
+static inline card_t handmask_nth(handmask_t mask, int n) {
+    for (int rank = 0; ; rank++) {
+        handmask_t bits = (mask >> rank) & 0x0001000100010001ULL;
+        for (; bits != 0; bits = handmask_rest(bits), n--) {
+            if (n == 0) {
+                return handmask_bit_card(__builtin_ctzll(bits) + rank);
+            }
+        }
+    }
+}
+
+handmask_t hand_mask(hand_t *hand);
+void handmask_to_hand(hand_t *dest, handmask_t mask);
+
+#endif
@@ -0,0 +1,13 @@
+#include "logging.h"
+
+// Messages below this level are not even formatted. Only written by
+// logging_set_level(), before any worker threads start.
+int logging_level = LOG_TRACE;
+
+/* Set the run-time log level: use this rather than log_set_level(), so
+ * that log_enabled() knows about it.
+ */
+void logging_set_level(int level) {
+    logging_level = level;
+    log_set_level(level);
+}
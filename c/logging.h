@@ -0,0 +1,55 @@
+#ifndef _LOGGING_H
+#define _LOGGING_H
+
+#include "async_log.h"
+#include "log.h"
+
+// Level checks on top of log.h, so that a disabled log statement costs
+// nothing: its arguments are not evaluated, and code that only exists to
+// build a message (buffers, stringbuilders) can be skipped with
+// log_enabled().
+//
+// A message is logged only if its level is at least LOG_MIN_LEVEL, which
+// is fixed at compile time (e.g. make LOG_MIN_LEVEL=LOG_INFO), and at
+// least the level set with logging_set_level() at run time. Below
+// LOG_MIN_LEVEL, log_enabled() is constant false and the compiler drops
+// the whole statement.
+//
+// While async logging is running (see async_log.h), enabled messages go
+// to async_log() instead of log_log().
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL LOG_TRACE
+#endif
+
+extern int logging_level;
+
+#define log_enabled(level) ((level) >= LOG_MIN_LEVEL && (level) >= logging_level)
+
+#define log_at(level, ...)                                              \
+    do {                                                                \
+        if (!log_enabled(level)) {                                      \
+        }                                                               \
+        else if (logging_async) {                                       \
+            async_log(level, __FILE__, __LINE__, __VA_ARGS__);          \
+        }                                                               \
+        else {                                                          \
+            log_log(level, __FILE__, __LINE__, __VA_ARGS__);            \
+        }                                                               \
+    } while (0)
+
+#undef log_trace
+#undef log_debug
+#undef log_info
+#undef log_warn
+#undef log_error
+#undef log_fatal
+#define log_trace(...) log_at(LOG_TRACE, __VA_ARGS__)
+#define log_debug(...) log_at(LOG_DEBUG, __VA_ARGS__)
+#define log_info(...)  log_at(LOG_INFO,  __VA_ARGS__)
+#define log_warn(...)  log_at(LOG_WARN,  __VA_ARGS__)
+#define log_error(...) log_at(LOG_ERROR, __VA_ARGS__)
+#define log_fatal(...) log_at(LOG_FATAL, __VA_ARGS__)
+
+void logging_set_level(int level);
+
+#endif
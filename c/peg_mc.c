@@ -0,0 +1,159 @@
+#define _POSIX_C_SOURCE 200809L    // for clock_gettime()
+
+#include <assert.h>
+#include <time.h>
+
+#include "handmask.h"
+#include "logging.h"
+#include "peg_mc.h"
+#include "rng.h"
+
+peg_mc_config_t peg_mc_config = {
+    nsamples: 64,
+    max_ns: 0,
+    rollout: peg_select_greedy,
+    seed: 0,
+};
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static bool ignore_points(void *data, int player, uint points) {
+    return false;
+}
+
+/* Add card (unless it is CARD_NONE) to seen, and to hash (FNV-1a over
+ * card codes).
+ */
+static void see_card(card_t card, handmask_t *seen, uint64_t *hash) {
+    if (card.suit != SUIT_NONE) {
+        *seen |= card_mask(card);
+    }
+    *hash = (*hash ^ card_code(card)) * 0x100000001b3ULL;
+}
+
+/* Add the cards of hand to seen and hash, as see_card() does. */
+static void see_hand(hand_t *hand, handmask_t *seen, uint64_t *hash) {
+    for (int i = 0; i < hand->ncards; i++) {
+        see_card(hand->cards[i], seen, hash);
+    }
+    *hash = (*hash ^ 0xff) * 0x100000001b3ULL;
+}
+
+/* Find the cards that other might hold, as far as player knows: every
+ * card that player has not seen (in their own hand, played, the starter
+ * or their own discards), and that is not ruled out by other having said
+ * go.
+ */
+void peg_mc_sampler_init(peg_mc_sampler_t *sampler, peg_state_t *peg, int player, int other) {
+    handmask_t seen = 0;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    see_hand(&peg->avail[player], &seen, &hash);
+    for (int r = 0; r < peg->num_rounds; r++) {
+        see_hand(&peg->cards_played[r], &seen, &hash);
+    }
+    see_hand(&peg->cur_played, &seen, &hash);
+    see_card(peg->starter, &seen, &hash);
+    see_card(peg->discards[player][0], &seen, &hash);
+    see_card(peg->discards[player][1], &seen, &hash);
+    hash = (hash ^ peg->min_value[other]) * 0x100000001b3ULL;
+
+    sampler->npool = 0;
+    for (handmask_t left = HANDMASK_DECK & ~seen; left != 0; left &= left - 1) {
+        card_t card = handmask_first(left);
+        if (rank_value[card.rank] >= peg->min_value[other]) {
+            sampler->pool[sampler->npool++] = card;
+        }
+    }
+    sampler->nhidden = peg->avail[other].ncards;
+    sampler->hash = hash;
+    assert(sampler->nhidden <= sampler->npool);
+}
+
+/* Deal hidden (sorted) a random hand from the sampler's pool. This is a
+ * partial Fisher-Yates shuffle, so the pool stays a permutation of itself.
+ */
+void peg_mc_sample(peg_mc_sampler_t *sampler, rng_t *rng, hand_t *hidden) {
+    card_t *pool = sampler->pool;
+    hand_truncate(hidden);
+    for (int i = 0; i < sampler->nhidden; i++) {
+        int j = i + rng_below(rng, sampler->npool - i);
+        card_t tmp = pool[i];
+        pool[i] = pool[j];
+        pool[j] = tmp;
+        hand_append(hidden, pool[i]);
+    }
+    sort_cards(hidden->ncards, hidden->cards);
+}
+
+// Monte Carlo pegging strategy: see peg_mc.h.
+int peg_select_mc(peg_state_t *peg, int player, int other) {
+    // The candidates: every card that fits, but only one of each rank.
+    hand_t *avail = &peg->avail[player];
+    int moves[HAND_MAX_CARDS];
+    int nmoves = 0;
+    uint ranks = 0;
+    for (int i = 0; i < avail->ncards; i++) {
+        card_t card = avail->cards[i];
+        if (peg->cur_count + rank_value[card.rank] <= 31 && !(ranks & (1 << card.rank))) {
+            ranks |= 1 << card.rank;
+            moves[nmoves++] = i;
+        }
+    }
+    if (nmoves == 0) {
+        return -1;
+    }
+    if (nmoves == 1) {
+        return moves[0];
+    }
+
+    // What this player knows also picks the RNG stream.
+    peg_mc_sampler_t sampler;
+    peg_mc_sampler_init(&sampler, peg, player, other);
+    rng_t rng;
+    rng_init(&rng, peg_mc_config.seed, sampler.hash);
+    peg_func_t rollout_func = peg_mc_config.rollout;
+    double deadline = (peg_mc_config.max_ns > 0) ? now_ns() + peg_mc_config.max_ns : 0;
+
+    int total[HAND_MAX_CARDS] = {0};
+    int nsamples = 0;
+    while (nsamples < peg_mc_config.nsamples) {
+        if (deadline > 0 && nsamples > 0 && now_ns() > deadline) {
+            break;
+        }
+
+        peg_state_t sample = *peg;
+        peg_mc_sample(&sampler, &rng, &sample.avail[other]);
+
+        // Try every candidate against this sample. (This is peg_play_out(),
+        // minus the bookkeeping and the logging at the end of the hand.)
+        for (int m = 0; m < nmoves; m++) {
+            peg_state_t rollout = sample;
+            peg_play_card(&rollout, moves[m], ignore_points, NULL);
+            while (!rollout.done) {
+                peg_next_turn(&rollout);
+                int selected = rollout_func(&rollout, rollout.player, rollout.other);
+                peg_play_card(&rollout, selected, ignore_points, NULL);
+            }
+            total[m] += ((int) (rollout.points[player] - peg->points[player]) -
+                         (int) (rollout.points[other] - peg->points[other]));
+        }
+        nsamples++;
+    }
+
+    int best = 0;
+    for (int m = 1; m < nmoves; m++) {
+        if (total[m] > total[best]) {
+            best = m;
+        }
+    }
+    log_trace("  peg_select_mc: %d samples, best card %d of %d, %+.2f points",
+              nsamples,
+              moves[best],
+              nmoves,
+              (double) total[best] / nsamples);
+    return moves[best];
+}
@@ -0,0 +1,47 @@
+#ifndef _PEG_MC_H
+#define _PEG_MC_H
+
+#include <stdint.h>
+
+#include "play.h"
+
+// peg_select_mc() is a pegging strategy that only uses what the player can
+// see: it deals the other player's hand at random from the cards it has
+// not seen (not in its own hand, not played so far, not the starter nor
+// its own discards), leaving out cards that a go by the other player
+// rules out (see peg_state_t.min_value), plays every
+// candidate card against that sample, rolls the rest of the pegging out
+// with a fast strategy for both players, and picks the card with the best
+// average point differential. Every candidate is rolled out against the
+// same samples, so they are compared on equal terms.
+//
+// Rollouts run on a copy of the peg_state_t, on the stack: nothing is
+// allocated. The samples for a position come from an RNG stream keyed by
+// (seed, the position), so with no time limit the strategy is
+// deterministic, whatever thread plays it and whatever it played before.
+typedef struct {
+    int nsamples;               // samples per decision
+    long max_ns;                // stop sampling after this long (0: no limit)
+    peg_func_t rollout;         // strategy for both players in rollouts
+    uint64_t seed;
+} peg_mc_config_t;
+
+// Settings for peg_select_mc(): set them before any games start.
+extern peg_mc_config_t peg_mc_config;
+
+int peg_select_mc(peg_state_t *peg, int player, int other);
+
+// Deals samples of the other player's hand, as player sees the position:
+// peg_mc_sampler_init() works out which cards the other player might hold,
+// and each peg_mc_sample() deals them a hand from those.
+typedef struct {
+    card_t pool[52];            // cards the other player might hold
+    int npool;
+    int nhidden;                // cards in the other player's hand
+    uint64_t hash;              // of everything player knows
+} peg_mc_sampler_t;
+
+void peg_mc_sampler_init(peg_mc_sampler_t *sampler, peg_state_t *peg, int player, int other);
+void peg_mc_sample(peg_mc_sampler_t *sampler, rng_t *rng, hand_t *hidden);
+
+#endif
@@ -0,0 +1,305 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc.h"
+#include "logging.h"
+#include "peg_solver.h"
+
+// Bigger than any point differential a hand of pegging can produce (and
+// small enough to fit in peg_tt_entry_t.value).
+#define VALUE_INF 100
+
+// Table size for peg_select_solver(): plenty for a 4-card hand.
+#define SELECT_BITS 12
+
+/* Create a solver with a transposition table of 2^bits entries. */
+peg_solver_t *new_peg_solver(int bits) {
+    peg_solver_t *solver = alloc_malloc(sizeof(peg_solver_t));
+    peg_solver_init(solver, alloc_malloc(sizeof(peg_tt_entry_t) << bits), bits);
+    return solver;
+}
+
+/* Set up solver to use table, an array of 2^bits entries owned by the
+ * caller.
+ */
+void peg_solver_init(peg_solver_t *solver, peg_tt_entry_t *table, int bits) {
+    memset(table, 0, sizeof(peg_tt_entry_t) << bits);
+    solver->table = table;
+    solver->mask = (1U << bits) - 1;
+    solver->gen = 0;
+    solver->nodes = 0;
+}
+
+/* Free a solver created by new_peg_solver(). */
+void peg_solver_free(peg_solver_t *solver) {
+    alloc_free(solver->table);
+    alloc_free(solver);
+}
+
+static bool ignore_points(void *data, int player, uint points) {
+    return false;
+}
+
+/* Transposition table key of the position peg, whose players still hold
+ * the root cards in left (see peg_solver.h for the layout).
+ */
+static uint64_t position_key(peg_state_t *peg, uint left) {
+    assert(peg->distinct <= 7);
+    uint64_t key = left
+        | (uint64_t) peg->cur_count << 16
+        | (uint64_t) peg->same_rank << 21
+        | (uint64_t) peg->player << 24
+        | (uint64_t) peg->blocked[0] << 25
+        | (uint64_t) peg->blocked[1] << 26
+        | (uint64_t) peg->distinct << 27;
+    int n = peg->cur_played.ncards;
+    for (int i = 0; i < peg->distinct; i++) {
+        key |= (uint64_t) peg->cur_played.cards[n - 1 - i].rank << (30 + 4 * i);
+    }
+    return key;
+}
+
+/* Return the legal moves for the player to move in moves[]: every card
+ * that fits under 31 (as an offset into avail), or just go (-1) if none
+ * does. Suits do not matter in pegging, so only one card of each rank is
+ * worth trying.
+ */
+static int legal_moves(peg_state_t *peg, int moves[]) {
+    hand_t *avail = &peg->avail[peg->player];
+    int nmoves = 0;
+    uint ranks = 0;
+    for (int i = 0; i < avail->ncards; i++) {
+        card_t card = avail->cards[i];
+        if (peg->cur_count + rank_value[card.rank] <= 31 && !(ranks & (1 << card.rank))) {
+            ranks |= 1 << card.rank;
+            moves[nmoves++] = i;
+        }
+    }
+    if (nmoves == 0) {
+        moves[nmoves++] = -1;
+    }
+    return nmoves;
+}
+
+/* Make move in peg, giving child (positioned at the next decision unless
+ * the hand is over) and the cards left in it. Returns the points the move
+ * scores for the player to move in peg, minus the other player's.
+ */
+static int play_move(peg_state_t *peg,
+                     uint left,
+                     int move,
+                     peg_state_t *child,
+                     uint *child_left) {
+    int player = peg->player;
+    int other = peg->other;
+    *child = *peg;
+    peg_play_card(child, move, ignore_points, NULL);
+    if (!child->done) {
+        peg_next_turn(child);
+    }
+
+    *child_left = left;
+    if (move >= 0) {
+        // The move-th card still in the player's hand is gone.
+        uint bits = (left >> (8 * player)) & 0xff;
+        for (int i = 0; i < move; i++) {
+            bits &= bits - 1;
+        }
+        *child_left &= ~((bits & -bits) << (8 * player));
+    }
+    return ((int) (child->points[player] - peg->points[player]) -
+            (int) (child->points[other] - peg->points[other]));
+}
+
+/* Alpha-beta search: return the value of peg for the player to move, or
+ * a bound on it if it is outside (alpha, beta).
+ */
+static int search(peg_solver_t *solver, peg_state_t *peg, uint left, int alpha, int beta) {
+    solver->nodes++;
+    uint64_t key = position_key(peg, left);
+    peg_tt_entry_t *entry = &solver->table[(key * 0x9e3779b97f4a7c15ULL) >> 32 & solver->mask];
+    int tt_best = -2;
+    if (entry->gen == solver->gen && entry->key == key) {
+        int value = entry->value;
+        if (entry->bound == PEG_BOUND_EXACT ||
+            (entry->bound == PEG_BOUND_LOWER && value >= beta) ||
+            (entry->bound == PEG_BOUND_UPPER && value <= alpha)) {
+            return value;
+        }
+        tt_best = entry->best;
+    }
+
+    // Try the best move from the table first, then the others by the points
+    // they score right away: good moves first means more cutoffs.
+    int moves[HAND_MAX_CARDS];
+    int priority[HAND_MAX_CARDS];
+    int nmoves = legal_moves(peg, moves);
+    for (int i = 0; i < nmoves; i++) {
+        int move = moves[i];
+        int prio = (move == tt_best) ? VALUE_INF
+            : (move >= 0) ? (int) peg_card_points(peg, peg->avail[peg->player].cards[move])
+            : 0;
+        int j = i;
+        for (; j > 0 && priority[j - 1] < prio; j--) {
+            moves[j] = moves[j - 1];
+            priority[j] = priority[j - 1];
+        }
+        moves[j] = move;
+        priority[j] = prio;
+    }
+
+    int orig_alpha = alpha;
+    int best_value = -VALUE_INF;
+    int best = moves[0];
+    for (int i = 0; i < nmoves; i++) {
+        peg_state_t child;
+        uint child_left;
+        int value = play_move(peg, left, moves[i], &child, &child_left);
+        if (!child.done) {
+            if (child.player == peg->player) {
+                value += search(solver, &child, child_left, alpha - value, beta - value);
+            }
+            else {
+                value -= search(solver, &child, child_left, value - beta, value - alpha);
+            }
+        }
+        if (value > best_value) {
+            best_value = value;
+            best = moves[i];
+        }
+        if (value > alpha) {
+            alpha = value;
+        }
+        if (alpha >= beta) {
+            break;
+        }
+    }
+
+    *entry = (peg_tt_entry_t) {
+        key: key,
+        gen: solver->gen,
+        value: best_value,
+        bound: (best_value <= orig_alpha) ? PEG_BOUND_UPPER
+             : (best_value >= beta) ? PEG_BOUND_LOWER
+             : PEG_BOUND_EXACT,
+        best: best,
+    };
+    return best_value;
+}
+
+/* Find a move from peg that achieves value (its exact value), and play it
+ * into child. Returns the move, and sets *child_value to the value of
+ * child for its player to move.
+ */
+static int best_move(peg_solver_t *solver,
+                     peg_state_t *peg,
+                     uint left,
+                     int value,
+                     peg_state_t *child,
+                     uint *child_left,
+                     int *child_value) {
+    int moves[HAND_MAX_CARDS];
+    int nmoves = legal_moves(peg, moves);
+    for (int i = 0; i < nmoves; i++) {
+        int gain = play_move(peg, left, moves[i], child, child_left);
+        *child_value = 0;
+        if (!child->done) {
+            *child_value = search(solver, child, *child_left, -VALUE_INF, VALUE_INF);
+        }
+        int sign = (child->done || child->player == peg->player) ? 1 : -1;
+        if (gain + sign * *child_value == value) {
+            return moves[i];
+        }
+    }
+    assert(false);
+    return -1;
+}
+
+/* Start a new solve of peg: returns the cards left at the root. */
+static uint solve_start(peg_solver_t *solver, peg_state_t *peg) {
+    assert(!peg->done);
+    assert(!peg->blocked[peg->player]);
+
+    // Entries from earlier solves are recognized by their generation;
+    // only when that wraps around does the table need clearing.
+    if (++solver->gen == 0) {
+        memset(solver->table, 0, sizeof(peg_tt_entry_t) * (solver->mask + 1));
+        solver->gen = 1;
+    }
+    return (((1U << peg->avail[0].ncards) - 1) |
+            ((1U << peg->avail[1].ncards) - 1) << 8);
+}
+
+/* Solve peg, which must be a position where a player has to move (as seen
+ * by a peg_func_t). Returns the points that the player to move will score
+ * from here, minus the other player's, if both play perfectly; and if
+ * solution is not NULL, fills it in with that value and the principal
+ * variation.
+ */
+int peg_solve(peg_solver_t *solver, peg_state_t *peg, peg_solution_t *solution) {
+    uint left = solve_start(solver, peg);
+    int value = search(solver, peg, left, -VALUE_INF, VALUE_INF);
+    if (solution == NULL) {
+        return value;
+    }
+
+    solution->value = value;
+    solution->nmoves = 0;
+    peg_state_t pos = *peg;
+    int pos_value = value;
+    while (!pos.done) {
+        peg_state_t child;
+        uint child_left;
+        int child_value;
+        int move = best_move(solver, &pos, left, pos_value, &child, &child_left, &child_value);
+
+        assert(solution->nmoves < PEG_SOLVE_MAX_MOVES);
+        peg_move_t *pv = &solution->moves[solution->nmoves++];
+        pv->player = pos.player;
+        pv->card = (move >= 0) ? pos.avail[pos.player].cards[move]
+            : (card_t) {suit: SUIT_NONE, rank: RANK_JOKER};
+
+        pos = child;
+        left = child_left;
+        pos_value = child_value;
+    }
+    return value;
+}
+
+/* Solve pegging hands[0] (pone, who plays first) against hands[1]
+ * (dealer) from the start. The value is player 0's points minus player
+ * 1's.
+ */
+int peg_solve_hands(peg_solver_t *solver, hand_t *hands[], peg_solution_t *solution) {
+    peg_state_t peg;
+    peg_state_reset(&peg, hands[0]->ncards);
+    peg_start(&peg, hands, NULL, CARD_NONE);
+    peg_next_turn(&peg);
+    return peg_solve(solver, &peg, solution);
+}
+
+/* Return a best move for the player to move in peg: an offset into their
+ * available cards, or -1 for go.
+ */
+int peg_solve_move(peg_solver_t *solver, peg_state_t *peg) {
+    uint left = solve_start(solver, peg);
+    int value = search(solver, peg, left, -VALUE_INF, VALUE_INF);
+    peg_state_t child;
+    uint child_left;
+    int child_value;
+    return best_move(solver, peg, left, value, &child, &child_left, &child_value);
+}
+
+// Perfect-information pegging strategy: play a best move according to the
+// solver. It looks at the other player's cards, so it is no real
+// strategy, but it is the benchmark for ones that are. Every thread that
+// uses it gets its own solver.
+int peg_select_solver(peg_state_t *peg, int player, int other) {
+    static __thread peg_tt_entry_t table[1 << SELECT_BITS];
+    static __thread peg_solver_t solver;
+    if (solver.table == NULL) {
+        peg_solver_init(&solver, table, SELECT_BITS);
+    }
+    return peg_solve_move(&solver, peg);
+}
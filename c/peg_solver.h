@@ -0,0 +1,77 @@
+#ifndef _PEG_SOLVER_H
+#define _PEG_SOLVER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "play.h"
+
+// A pegging solver finds the result of perfect play when both players'
+// cards are known: the best point differential that the player to move
+// can force, by the rules of peg_hands() (go, 15, 31, pairs, runs, last
+// card), and a principal variation that achieves it.
+//
+// It is an alpha-beta search over peg_state_t positions, played on with
+// peg_play_card(), with a transposition table keyed on everything that
+// can still affect the score:
+//
+//   bits  0-15: which of the cards left at the root are still in hand
+//               (player 0 in the low byte, player 1 in the high byte)
+//   bits 16-20: current count
+//   bits 21-23: number of cards of the same rank at the end of the round
+//   bit  24:    player to move
+//   bits 25-26: blocked[0], blocked[1]
+//   bits 27-29: length of the distinct tail of the round (see peg_state_t)
+//   bits 30-57: ranks of that tail, most recent first
+//
+// Card identities are relative to the position being solved, so entries
+// are only valid for one solve: every solve gets a new generation number
+// instead of clearing the table.
+enum {
+    PEG_BOUND_EXACT,
+    PEG_BOUND_LOWER,            // value is at least this
+    PEG_BOUND_UPPER,            // value is at most this
+};
+
+typedef struct {
+    uint64_t key;
+    uint32_t gen;
+    int8_t value;
+    uint8_t bound;              // PEG_BOUND_*
+    int8_t best;                // best move: offset into avail, or -1 (go)
+} peg_tt_entry_t;
+
+typedef struct {
+    peg_tt_entry_t *table;
+    uint32_t mask;              // number of entries - 1
+    uint32_t gen;
+    uint64_t nodes;             // positions searched, over all solves
+} peg_solver_t;
+
+// One move of a principal variation: player plays card, or says go if
+// card is a joker.
+typedef struct {
+    uint8_t player;
+    card_t card;
+} peg_move_t;
+
+// A hand of pegging has at most one move per card, plus a go for every
+// count that is not 31.
+#define PEG_SOLVE_MAX_MOVES (4 * HAND_MAX_CARDS)
+
+typedef struct {
+    int value;                  // points to player to move, minus the other's
+    int nmoves;
+    peg_move_t moves[PEG_SOLVE_MAX_MOVES];
+} peg_solution_t;
+
+peg_solver_t *new_peg_solver(int bits);
+void peg_solver_init(peg_solver_t *solver, peg_tt_entry_t *table, int bits);
+void peg_solver_free(peg_solver_t *solver);
+int peg_solve(peg_solver_t *solver, peg_state_t *peg, peg_solution_t *solution);
+int peg_solve_hands(peg_solver_t *solver, hand_t *hands[], peg_solution_t *solution);
+int peg_solve_move(peg_solver_t *solver, peg_state_t *peg);
+
+int peg_select_solver(peg_state_t *peg, int player, int other);
+
+#endif
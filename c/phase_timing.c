@@ -0,0 +1,145 @@
+#define _POSIX_C_SOURCE 200809L    // for clock_gettime()
+
+#include <string.h>
+#include <time.h>
+
+#include "logging.h"
+#include "phase_timing.h"
+
+#ifdef PHASE_TIMING
+
+// Every thread that times anything gets one of these slots for good, so
+// the counters of threads that have finished are still there for the
+// report. Threads beyond the last slot share it (and may lose counts).
+#define PHASE_MAX_THREADS 256
+
+typedef struct {
+    phase_stats_t stats;
+} __attribute__((aligned(64))) phase_slot_t;
+
+static phase_slot_t slots[PHASE_MAX_THREADS];
+static int nslots = 0;
+
+__thread phase_stats_t *phase_stats = NULL;
+
+// When the first slot was claimed, by both clocks: for converting ticks
+// to time in the report.
+static uint64_t start_ticks;
+static uint64_t start_ns;
+
+static const char *phase_names[PHASE_COUNT] = {
+    "game",
+    "deal",
+    "hand",
+    "discard",
+    "discard_func",
+    "peg",
+    "peg_func",
+    "show",
+};
+
+static const int phase_parent[PHASE_COUNT] = {
+    -1,
+    PHASE_GAME,
+    PHASE_GAME,
+    PHASE_HAND,
+    PHASE_DISCARD,
+    PHASE_HAND,
+    PHASE_PEG,
+    PHASE_HAND,
+};
+
+uint64_t phase_clock_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Give the calling thread a slot for its counters. */
+phase_stats_t *phase_claim_stats(void) {
+    int slot = __atomic_fetch_add(&nslots, 1, __ATOMIC_RELAXED);
+    if (slot == 0) {
+        start_ns = phase_clock_ns();
+        start_ticks = phase_now();
+    }
+    if (slot >= PHASE_MAX_THREADS) {
+        slot = PHASE_MAX_THREADS - 1;
+    }
+    phase_stats = &slots[slot].stats;
+    return phase_stats;
+}
+
+/* Add up the counters of every thread into totals, and return how long a
+ * tick is. Only meaningful once the threads being timed are done.
+ */
+void phase_timing_totals(phase_stats_t *totals, double *ns_per_tick) {
+    memset(totals, 0, sizeof(*totals));
+    int n = __atomic_load_n(&nslots, __ATOMIC_ACQUIRE);
+    if (n > PHASE_MAX_THREADS) {
+        n = PHASE_MAX_THREADS;
+    }
+    for (int i = 0; i < n; i++) {
+        for (int p = 0; p < PHASE_COUNT; p++) {
+            totals->ticks[p] += slots[i].stats.ticks[p];
+            totals->calls[p] += slots[i].stats.calls[p];
+        }
+    }
+
+    *ns_per_tick = 1.0;
+#if defined(__x86_64__)
+    uint64_t ticks = phase_now() - start_ticks;
+    if (n > 0 && ticks > 0) {
+        *ns_per_tick = (double) (phase_clock_ns() - start_ns) / ticks;
+    }
+#endif
+}
+
+/* Log where the time went, over all threads: time and share of the total
+ * for each phase, and throughput. Rates are per thread-second, i.e. what
+ * one thread does, however many ran.
+ */
+void phase_timing_report(void) {
+    phase_stats_t totals;
+    double ns_per_tick;
+    phase_timing_totals(&totals, &ns_per_tick);
+    if (totals.calls[PHASE_GAME] == 0) {
+        return;
+    }
+
+    double total_s = totals.ticks[PHASE_GAME] * ns_per_tick / 1e9;
+    log_info("phase timing: %.3f thread-seconds in %lu games",
+             total_s,
+             (unsigned long) totals.calls[PHASE_GAME]);
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        int depth = 0;
+        for (int q = phase_parent[p]; q != -1; q = phase_parent[q]) {
+            depth++;
+        }
+        double seconds = totals.ticks[p] * ns_per_tick / 1e9;
+        log_info("  %*s%-*s %9.3f s %6.1f%% %12lu calls %9.0f ns/call",
+                 2 * depth, "",
+                 20 - 2 * depth, phase_names[p],
+                 seconds,
+                 100.0 * seconds / total_s,
+                 (unsigned long) totals.calls[p],
+                 totals.calls[p] > 0 ? seconds * 1e9 / totals.calls[p] : 0.0);
+    }
+
+    uint64_t decisions = totals.calls[PHASE_DISCARD_FUNC] + totals.calls[PHASE_PEG_FUNC];
+    log_info("phase timing: %.0f games/sec, %.0f hands/sec, %.0f decisions/sec per thread",
+             totals.calls[PHASE_GAME] / total_s,
+             totals.calls[PHASE_HAND] / total_s,
+             decisions / total_s);
+}
+
+#else
+
+void phase_timing_totals(phase_stats_t *totals, double *ns_per_tick) {
+    memset(totals, 0, sizeof(*totals));
+    *ns_per_tick = 1.0;
+}
+
+void phase_timing_report(void) {
+}
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef _PHASE_TIMING_H
+#define _PHASE_TIMING_H
+
+#include <stdint.h>
+
+// Optional instrumentation of where the time of a game goes: build with
+// -DPHASE_TIMING (make PHASE_TIMING=1) and each phase of play_game(), and
+// each call of a strategy, is timed and counted, per thread. Without it,
+// phase_begin(), phase_end() and phase_time() compile to nothing (or to
+// just the statement timed).
+//
+// Phases nest as listed (see phase_parent[] in phase_timing.c): e.g. time
+// in peg_func is also time in peg, hand and game. phase_timing_report()
+// logs the totals over all threads at the end of a run.
+typedef enum {
+    PHASE_GAME,                 // play_game()
+    PHASE_DEAL,                 //   deal_batch()
+    PHASE_HAND,                 //   play_hand()
+    PHASE_DISCARD,              //     picking up, sorting and discarding
+    PHASE_DISCARD_FUNC,         //       discard strategy calls
+    PHASE_PEG,                  //     peg_hands()
+    PHASE_PEG_FUNC,             //       pegging strategy calls
+    PHASE_SHOW,                 //     scoring the hands and the crib
+    PHASE_COUNT,
+} phase_t;
+
+// Timestamps are TSC ticks on x86-64 (converted to time when reporting),
+// and nanoseconds of CLOCK_MONOTONIC elsewhere.
+typedef struct {
+    uint64_t ticks[PHASE_COUNT];
+    uint64_t calls[PHASE_COUNT];
+} phase_stats_t;
+
+#ifdef PHASE_TIMING
+
+// This thread's counters (NULL until it first needs them).
+extern __thread phase_stats_t *phase_stats;
+
+phase_stats_t *phase_claim_stats(void);
+uint64_t phase_clock_ns(void);
+
+static inline uint64_t phase_now(void) {
+#if defined(__x86_64__)
+    return __builtin_ia32_rdtsc();
+#else
+    return phase_clock_ns();
+#endif
+}
+
+static inline void phase_add(phase_t phase, uint64_t ticks) {
+    phase_stats_t *stats = (phase_stats != NULL) ? phase_stats : phase_claim_stats();
+    stats->ticks[phase] += ticks;
+    stats->calls[phase]++;
+}
+
+// Time a stretch of a function: phase_begin() declares the start time, so
+// each phase can only be begun once per scope.
+#define phase_begin(phase) uint64_t phase_start_##phase = phase_now()
+#define phase_end(phase) phase_add(phase, phase_now() - phase_start_##phase)
+
+// Time one statement, e.g. phase_time(PHASE_DEAL, deal_batch(...)).
+#define phase_time(phase, ...) do {                         \
+        uint64_t phase_start_ = phase_now();                \
+        __VA_ARGS__;                                        \
+        phase_add(phase, phase_now() - phase_start_);       \
+    } while (0)
+
+#else
+
+#define phase_begin(phase) ((void) 0)
+#define phase_end(phase) ((void) 0)
+#define phase_time(phase, ...) do { __VA_ARGS__; } while (0)
+
+#endif
+
+void phase_timing_totals(phase_stats_t *totals, double *ns_per_tick);
+void phase_timing_report(void);
+
+#endif
@@ -4,18 +4,23 @@
 #include <stdlib.h>
 #include <string.h>
 
-#include "log.h"
+#include "alloc.h"
+#include "crib.h"
+#include "logging.h"
+#include "peg_mc.h"
+#include "peg_solver.h"
+#include "phase_timing.h"
 #include "play.h"
+#include "probes.h"
 #include "score.h"
-#include "stringbuilder.h"
 #include "twiddle.h"
 
 gamestate_t gamestate_init() {
     return (gamestate_t) {
         player_name: {PLAYER_NOBODY, PLAYER_NOBODY},
         strategy: {
-            (strategy_t) {peg_func: NULL, discard_func: NULL},
-            (strategy_t) {peg_func: NULL, discard_func: NULL},
+            (strategy_t) {peg_func: NULL, discard_func: NULL, discard_data: NULL},
+            (strategy_t) {peg_func: NULL, discard_func: NULL, discard_data: NULL},
         },
         score: {0, 0},
         winner: PLAYER_NOBODY,
@@ -33,18 +38,12 @@ char playername_as_char(playername_t name) {
 
 /* Drop one card from hand (modify hand in place). */
 void drop_one(hand_t *hand, int drop) {
-    card_t keep_cards[6];
-
-    for (int src = 0, dst = 0; src < hand->ncards; src++) {
-        if (src != drop) {
-            keep_cards[dst++] = hand->cards[src];
-        }
-    }
-    hand->ncards--;
-    memcpy(hand->cards, keep_cards, sizeof(card_t) * hand->ncards);
+    hand_delete(hand, drop);
 }
 
-/* Copy src_hand into dest_hand, dropping two cards along the way. */
+/* Copy src_hand into dest_hand, dropping two cards along the way. They
+ * may be the same hand.
+ */
 void drop_two(hand_t *dest_hand, hand_t *src_hand, int drop1, int drop2) {
     assert(dest_hand->size >= src_hand->ncards - 2);
     for (int src = 0, dst = 0; src < src_hand->ncards; src++) {
@@ -73,24 +72,26 @@ void eval_candidate_simple(int ncards, int indexes[], void *_data) {
     assert(candidate->size == ncards);
     assert(winner->size >= ncards);
 
-    size_t size = 50;
-    int offset = 0;
-    char buf[size];
-    strncpy(buf, "eval_candidate_simple: {", size);
-    offset = strlen(buf);
-    for (int i = 0; i < ncards; i++) {
-        int nbytes = snprintf(buf + offset, size - offset, "%d", indexes[i]);
-        assert(nbytes < size - offset);
-        offset += nbytes;
-        if (i < ncards - 1) {
-            assert(size - offset >= 1);
-            buf[offset] = ',';
-            offset++;
+    if (log_enabled(LOG_TRACE)) {
+        size_t size = 50;
+        int offset = 0;
+        char buf[size];
+        strncpy(buf, "eval_candidate_simple: {", size);
+        offset = strlen(buf);
+        for (int i = 0; i < ncards; i++) {
+            int nbytes = snprintf(buf + offset, size - offset, "%d", indexes[i]);
+            assert(nbytes < size - offset);
+            offset += nbytes;
+            if (i < ncards - 1) {
+                assert(size - offset >= 1);
+                buf[offset] = ',';
+                offset++;
+            }
         }
+        assert(size - offset >= 1);
+        strncpy(buf + offset, "}", size - offset);
+        log_trace("%s", buf);
     }
-    assert(size - offset >= 1);
-    strncpy(buf + offset, "}", size - offset);
-    log_trace(buf);
 
     hand_truncate(candidate);
     for (int i = 0; i < ncards; i++) {
@@ -117,23 +118,24 @@ void eval_candidate_simple(int ncards, int indexes[], void *_data) {
 /* Discard two cards that maximize the fixed score -- i.e. the score
  * from the 4 cards kept, ignoring the starter card.
  */
-void discard_simple(hand_t *hand, hand_t *crib) {
-    hand_t *candidate = new_hand(4);
-    hand_t *winner = new_hand(4);
+void discard_simple(hand_t *hand, hand_t *crib, discard_ctx_t *ctx) {
+    hand_t candidate, winner;
+    hand_init(&candidate, 4);
+    hand_init(&winner, 4);
 
-    discard_data_t data = {0, hand, candidate, winner};
+    discard_data_t data = {0, hand, &candidate, &winner};
     iter_combos(hand->ncards, 4, eval_candidate_simple, (void *) &data);
 
     // In case every candidate had score 0, arbitrarily pick the last one.
     if (data.top_score == 0) {
-        copy_hand(winner, candidate);
+        copy_hand(&winner, &candidate);
     }
 
     // Add discarded cards to the crib.
     for (int i = 0; i < hand->ncards; i++) {
         bool kept = false;
-        for (int j = 0; j < winner->ncards; j++) {
-            if (card_cmp(&hand->cards[i], &winner->cards[j]) == 0) {
+        for (int j = 0; j < winner.ncards; j++) {
+            if (card_cmp(&hand->cards[i], &winner.cards[j]) == 0) {
                 kept = true;
                 break;
             }
@@ -143,60 +145,256 @@ void discard_simple(hand_t *hand, hand_t *crib) {
         }
     }
 
-    log_cards(LOG_TRACE, "winning candidate", winner->ncards, winner->cards);
-    copy_hand(hand, winner);
-
-    free(winner);
-    free(candidate);
+    log_cards(LOG_TRACE, "winning candidate", winner.ncards, winner.cards);
+    copy_hand(hand, &winner);
 }
 
 /* Discard two cards at random. */
-void discard_random(hand_t *hand, hand_t *crib) {
+void discard_random(hand_t *hand, hand_t *crib, discard_ctx_t *ctx) {
     int drop1, drop2;
-    drop1 = rand() % hand->ncards;
-    while ((drop2 = rand() % hand->ncards) == drop1) {
+    drop1 = rng_below(ctx->rng, hand->ncards);
+    drop2 = rng_below(ctx->rng, hand->ncards - 1);
+    if (drop2 >= drop1) {
+        drop2++;
     }
     log_trace("discard_random: drop1=%d, drop2=%d", drop1, drop2);
 
     hand_append(crib, hand->cards[drop1]);
     hand_append(crib, hand->cards[drop2]);
 
-    hand_t *tmp_hand = new_hand(hand->ncards - 2);
-    drop_two(tmp_hand, hand, drop1, drop2);
-    copy_hand(hand, tmp_hand);
-    free(tmp_hand);
+    drop_two(hand, hand, drop1, drop2);
 }
 
-peg_state_t *new_peg_state(int ncards) {
-    peg_state_t *peg = (peg_state_t *) calloc(1, sizeof(peg_state_t));
-    peg->num_rounds = 0;
-    peg->avail[0] = new_hand(ncards);
-    peg->avail[1] = new_hand(ncards);
-    peg->cur_played = new_hand(ncards * 2);
-    memset(peg->cards_played, 0, sizeof(hand_t *) * MAX_ROUNDS);
+// The 15 ways to keep 4 cards out of 6, by the positions of the two cards
+// that go to the crib.
+const uint8_t discard_pairs[DISCARD_OPTIONS][2] = {
+    {0, 1}, {0, 2}, {0, 3}, {0, 4}, {0, 5},
+    {1, 2}, {1, 3}, {1, 4}, {1, 5},
+    {2, 3}, {2, 4}, {2, 5},
+    {3, 4}, {3, 5},
+    {4, 5},
+};
+
+/* Return the total score of the 4 cards in keep (sorted) over every
+ * possible starter, i.e. over the 46 cards not in the dealt hand.
+ * rank_left[r] and suit_left[s] count the possible starters of rank r
+ * and of suit s. Dividing by 46 gives the expected score of the keep.
+ */
+static uint keep_total(card_t keep[4], uint8_t rank_left[], uint8_t suit_left[]) {
+    uint8_t ranks[4];
+    uint8_t points[RANK_KING + 1];
+    for (int i = 0; i < 4; i++) {
+        ranks[i] = keep[i].rank;
+    }
+    score_starter_ranks(4, ranks, points);
 
-    return peg;
+    uint total = 0;
+    for (int rank = RANK_ACE; rank <= RANK_KING; rank++) {
+        total += rank_left[rank] * points[rank];
+    }
+
+    // A 4-card flush is worth 4 with any starter, and 5 if the starter
+    // matches. A jack is worth 1 (nobs) with any starter of its suit.
+    suit_t suit = keep[0].suit;
+    if (keep[1].suit == suit && keep[2].suit == suit && keep[3].suit == suit) {
+        total += 4 * 46 + suit_left[suit];
+    }
+    for (int i = 0; i < 4; i++) {
+        if (keep[i].rank == RANK_JACK) {
+            total += suit_left[keep[i].suit];
+        }
+    }
+    return total;
 }
 
-void peg_state_free(peg_state_t *peg) {
-    free(peg->avail[0]);
-    free(peg->avail[1]);
-    if (peg->cur_played != NULL) {
-        free(peg->cur_played);
+/* Compute the value of each of the DISCARD_OPTIONS ways to discard from
+ * a sorted 6-card hand: the expected score of the 4 cards kept, averaged
+ * over all 46 possible starters -- plus, if with_crib is true, the
+ * expected value of the two cards discarded to the crib according to
+ * crib_value(). Allocates nothing.
+ */
+void discard_values(hand_t *hand, bool dealer, bool with_crib, float value[]) {
+    assert(hand->ncards == DEAL_HAND_CARDS);
+
+    uint8_t rank_left[RANK_KING + 1];
+    uint8_t suit_left[SUIT_SPADE + 1];
+    for (int rank = RANK_ACE; rank <= RANK_KING; rank++) {
+        rank_left[rank] = 4;
     }
-    for (int i = 0; i < MAX_ROUNDS; i++) {
-        if (peg->cards_played[i] != NULL) {
-            free(peg->cards_played[i]);
+    for (int suit = SUIT_CLUB; suit <= SUIT_SPADE; suit++) {
+        suit_left[suit] = 13;
+    }
+    for (int i = 0; i < hand->ncards; i++) {
+        assert(i == 0 || hand->cards[i - 1].rank <= hand->cards[i].rank);
+        rank_left[hand->cards[i].rank]--;
+        suit_left[hand->cards[i].suit]--;
+    }
+
+    card_t keep[4];
+    for (int option = 0; option < DISCARD_OPTIONS; option++) {
+        card_t drop1 = hand->cards[discard_pairs[option][0]];
+        card_t drop2 = hand->cards[discard_pairs[option][1]];
+        for (int src = 0, dst = 0; src < hand->ncards; src++) {
+            if (src != discard_pairs[option][0] && src != discard_pairs[option][1]) {
+                keep[dst++] = hand->cards[src];
+            }
+        }
+        value[option] = keep_total(keep, rank_left, suit_left) / 46.0f;
+        if (with_crib) {
+            // Points in our own crib are ours, in the other crib they
+            // are our opponent's.
+            float crib_ev = crib_value(drop1, drop2, dealer);
+            value[option] += dealer ? crib_ev : -crib_ev;
+        }
+        log_trace("discard_values: option %d: value = %.2f", option, value[option]);
+    }
+}
+
+/* Return the option with the highest value. Ignore ties -- just use the
+ * first option to get to the top.
+ */
+int discard_best_option(float value[]) {
+    int best = 0;
+    for (int option = 1; option < DISCARD_OPTIONS; option++) {
+        if (value[option] > value[best]) {
+            best = option;
         }
     }
-    free(peg);
+    return best;
+}
+
+/* Move discards[0] and discards[1] from hand to crib. */
+void discard_cards(hand_t *hand, hand_t *crib, card_t discards[2]) {
+    for (int d = 0; d < 2; d++) {
+        for (int i = 0; i < hand->ncards; i++) {
+            if (card_cmp(&hand->cards[i], &discards[d]) == 0) {
+                hand_append(crib, hand->cards[i]);
+                hand_delete(hand, i);
+                break;
+            }
+        }
+    }
+}
+
+/* Discard the option with the highest value from discard_values(). */
+static void discard_best_keep(hand_t *hand, hand_t *crib, bool dealer, bool with_crib) {
+    float value[DISCARD_OPTIONS];
+    discard_values(hand, dealer, with_crib, value);
+    int best = discard_best_option(value);
+
+    int drop1 = discard_pairs[best][0];
+    int drop2 = discard_pairs[best][1];
+    log_trace("discard_best_keep: drop1=%d, drop2=%d, expected value = %.2f",
+              drop1, drop2, value[best]);
+    hand_append(crib, hand->cards[drop1]);
+    hand_append(crib, hand->cards[drop2]);
+    hand_delete(hand, drop2);
+    hand_delete(hand, drop1);
+}
+
+/* Discard the two cards that maximize the expected score of the 4 cards
+ * kept, averaged over all 46 possible starters.
+ */
+void discard_expected(hand_t *hand, hand_t *crib, discard_ctx_t *ctx) {
+    discard_best_keep(hand, crib, ctx->dealer, false);
+}
+
+/* Like discard_expected(), but also count the expected value of the
+ * discards to the crib: for the dealer, or against the pone. Without a
+ * crib table (see crib_table_use()), this is the same as
+ * discard_expected().
+ */
+void discard_crib(hand_t *hand, hand_t *crib, discard_ctx_t *ctx) {
+    discard_best_keep(hand, crib, ctx->dealer, true);
+}
+
+// deterministic: the decision depends only on the hand and the dealer
+// flag, never on ctx->rng, so it can be cached (see discard_cache.h).
+static const struct {
+    const char *name;
+    discard_func_t func;
+    bool deterministic;
+} discard_funcs[] = {
+    {"simple", discard_simple, true},
+    {"random", discard_random, false},
+    {"expected", discard_expected, true},
+    {"crib", discard_crib, true},
+};
+
+/* Return the discard strategy called name, or NULL if there is none. */
+discard_func_t discard_func_by_name(const char *name) {
+    for (int i = 0; i < sizeof(discard_funcs) / sizeof(discard_funcs[0]); i++) {
+        if (strcmp(discard_funcs[i].name, name) == 0) {
+            return discard_funcs[i].func;
+        }
+    }
+    return NULL;
+}
+
+/* Return true if func is one of the strategies above that never draws
+ * from ctx->rng. Strategies this does not know about count as random.
+ */
+bool discard_func_deterministic(discard_func_t func) {
+    for (int i = 0; i < sizeof(discard_funcs) / sizeof(discard_funcs[0]); i++) {
+        if (discard_funcs[i].func == func) {
+            return discard_funcs[i].deterministic;
+        }
+    }
+    return false;
+}
+
+/* Start a new round of pegging: the count goes back to zero. */
+static void peg_new_round(peg_state_t *peg) {
+    hand_truncate(&peg->cur_played);
+    peg->cur_count = 0;
+    memset(peg->rank_pos, -1, sizeof(peg->rank_pos));
+    peg->same_rank = 0;
+    peg->distinct = 0;
+    peg->rank_sum[0] = 0;
+}
+
+/* Reset peg, in place, for pegging hands of ncards cards. */
+void peg_state_reset(peg_state_t *peg, int ncards) {
+    peg->num_rounds = 0;
+    peg->points[0] = 0;
+    peg->points[1] = 0;
+    hand_init(&peg->avail[0], ncards);
+    hand_init(&peg->avail[1], ncards);
+    hand_init(&peg->cur_played, ncards * 2);
+    peg_new_round(peg);
+    for (int i = 0; i < MAX_ROUNDS; i++) {
+        hand_init(&peg->cards_played[i], ncards * 2);
+        peg->counts[i] = 0;
+    }
+    peg->player = 1;
+    peg->other = 0;
+    peg->blocked[0] = false;
+    peg->blocked[1] = false;
+    peg->need_reset = false;
+    peg->done = false;
+    peg->starter = CARD_NONE;
+    for (int p = 0; p < 2; p++) {
+        peg->discards[p][0] = CARD_NONE;
+        peg->discards[p][1] = CARD_NONE;
+        peg->min_value[p] = 0;
+    }
+}
+
+peg_state_t *new_peg_state(int ncards) {
+    peg_state_t *peg = (peg_state_t *) alloc_malloc(sizeof(peg_state_t));
+    peg_state_reset(peg, ncards);
+    return peg;
+}
+
+void peg_state_free(peg_state_t *peg) {
+    alloc_free(peg);
 }
 
 // Naive pegging strategy: select the smallest available card, as long
 // as we don't go over 31. Assumes the arrays of available cards are
 // sorted.
 int peg_select_low(peg_state_t *peg, int player, int other) {
-    hand_t *avail = peg->avail[player];
+    hand_t *avail = &peg->avail[player];
     card_t card = avail->cards[0];
     if (peg->cur_count + rank_value[card.rank] <= 31) {
         return 0;
@@ -208,7 +406,7 @@ int peg_select_low(peg_state_t *peg, int player, int other) {
 // doesn't go over 31. Assumes the arrays of available cards are
 // sorted.
 int peg_select_high(peg_state_t *peg, int player, int other) {
-    hand_t *avail = peg->avail[player];
+    hand_t *avail = &peg->avail[player];
     for (int i = avail->ncards - 1; i >= 0; i--) {
         card_t card = avail->cards[i];
         uint count = peg->cur_count + rank_value[card.rank];
@@ -221,124 +419,216 @@ int peg_select_high(peg_state_t *peg, int player, int other) {
     return -1;
 }
 
-uint peg_count_pairs(peg_state_t *peg, int player) {
-    uint same_rank = 1;
-    uint pair_points = 0;
-    card_t last_played = peg->cur_played->cards[peg->cur_played->ncards - 1];
-    for (int i = peg->cur_played->ncards - 2; i >= 0; i--) {
-        card_t played = peg->cur_played->cards[i];
-        if (played.rank == last_played.rank) {
-            same_rank++;
-            if (same_rank == 2) {
-                pair_points = 2;
-            }
-            else {
-                pair_points *= same_rank;     // 3-of-a-kind = 6, 4-of-a-kind = 12
-            }
+// Greedy pegging strategy: select the card that scores the most points
+// right now (the lowest such card, if there is a tie), as long as we
+// don't go over 31.
+int peg_select_greedy(peg_state_t *peg, int player, int other) {
+    hand_t *avail = &peg->avail[player];
+    int best = -1;
+    int best_points = -1;
+    for (int i = 0; i < avail->ncards; i++) {
+        card_t card = avail->cards[i];
+        if (peg->cur_count + rank_value[card.rank] > 31) {
+            continue;
         }
-        else {
-            break;
+        int points = peg_card_points(peg, card);
+        if (points > best_points) {
+            best = i;
+            best_points = points;
         }
     }
-    if (pair_points > 0) {
-        log_trace("  found %d-of-a-kind, %d points to player %d",
-                  same_rank,
-                  pair_points,
-                  player);
-    }
-    return pair_points;
+    return best;
 }
 
-uint peg_count_runs(peg_state_t *peg, int player) {
-    // cur_played = {4, 6, 8, 7}       : run of 3
-    // cur_played = {A, 3, 5, 7, 8}    : no runs
-    // cur_played = {3, A, 5, 7, 8, 6} : run of 4
-    // cur_played = {2, 5, 6, 4}       : run of 3
-    // cur_played = {2, 5, 6, 4, 7}    : run of 4 (preceding run already counted)
-    // cur_played = {A, 2, 3, 4, 5, 6, 7}: run of 7 (longest possible)
-
-    uint max_run = 7;
-    if (peg->cur_played->ncards < max_run) {
-        max_run = peg->cur_played->ncards;
+static const struct {
+    const char *name;
+    peg_func_t func;
+} peg_func_names[] = {
+    {"low", peg_select_low},
+    {"high", peg_select_high},
+    {"greedy", peg_select_greedy},
+    {"mc", peg_select_mc},
+    {"solver", peg_select_solver},
+};
+
+/* Return the pegging strategy called name, or NULL if there is none. */
+peg_func_t peg_func_by_name(const char *name) {
+    for (int i = 0; i < sizeof(peg_func_names) / sizeof(peg_func_names[0]); i++) {
+        if (strcmp(peg_func_names[i].name, name) == 0) {
+            return peg_func_names[i].func;
+        }
     }
+    return NULL;
+}
 
-    card_t *after = peg->cur_played->cards + peg->cur_played->ncards;
-    card_t candidate[max_run];
-    for (int len = max_run; len >= 3; len--) {
-        memcpy(candidate, after - len, len * sizeof(card_t));
-        sort_cards(len, candidate);
+/* Points for pairs (2 for a pair, 6 for three of a kind, 12 for four)
+ * that card would score if played now.
+ */
+uint peg_pair_points(peg_state_t *peg, card_t card) {
+    int n = peg->cur_played.ncards;
+    if (n == 0 || peg->cur_played.cards[n - 1].rank != card.rank) {
+        return 0;
+    }
+    uint same_rank = peg->same_rank + 1;
+    return same_rank * (same_rank - 1);
+}
 
-        int found_run = len;
-        rank_t prev_rank = candidate[0].rank;
-        for (int i = 1; i < len; i++) {
-            if (prev_rank == RANK_KING || candidate[i].rank != prev_rank + 1) {
-                found_run = 0;
-            }
-            prev_rank = candidate[i].rank;
-        }
-        if (found_run > 0) {
-            log_trace("  found run of %d: %d points to player %d",
-                      found_run,
-                      found_run,
-                      player);
-            return found_run;
+/* Points for a run that card would score if played now: the length of the
+ * longest tail of the round, ending with card, whose ranks are distinct
+ * and consecutive (in any order). E.g. after
+ *
+ *   {4, 6, 8} playing 7 makes a run of 3
+ *   {A, 3, 5, 7} playing 8: no run
+ *   {3, A, 5, 7, 8} playing 6 makes a run of 4
+ *   {2, 5, 6, 4} playing 7 makes a run of 4 (though 4-5-6 was already counted)
+ *   {A, 2, 3, 4, 5, 6} playing 7 makes a run of 7 (longest possible)
+ */
+uint peg_run_points(peg_state_t *peg, card_t card) {
+    int n = peg->cur_played.ncards;
+    uint bit = 1 << card.rank;
+
+    // The longest tail ending with card that has no repeated rank.
+    int distinct = peg->distinct + 1;
+    if (n - peg->rank_pos[card.rank] < distinct) {
+        distinct = n - peg->rank_pos[card.rank];
+    }
+    for (int len = distinct; len >= 3; len--) {
+        uint mask = peg->rank_sum[n] + bit - peg->rank_sum[n + 1 - len];
+        if ((mask >> __builtin_ctz(mask)) == (1u << len) - 1) {
+            return len;
         }
     }
     return 0;
 }
 
+/* Total points the current player would score by playing card now:
+ * fifteen or 31, pairs, runs, and last card. The card must fit under 31.
+ */
+uint peg_card_points(peg_state_t *peg, card_t card) {
+    uint count = peg->cur_count + rank_value[card.rank];
+    assert(count <= 31);
+    bool last_card = (peg->avail[peg->other].ncards == 0 &&
+                      peg->avail[peg->player].ncards == 1);
+
+    uint points = 0;
+    if (count == 15) {
+        points += 2;
+    }
+    else if (count == 31) {
+        points += (peg->blocked[peg->other] || last_card) ? 1 : 2;
+    }
+    points += peg_pair_points(peg, card);
+    points += peg_run_points(peg, card);
+    points += last_card;
+    return points;
+}
+
+/* Add card to the current round. */
+static void peg_append(peg_state_t *peg, card_t card) {
+    int n = peg->cur_played.ncards;
+    if (n > 0 && peg->cur_played.cards[n - 1].rank == card.rank) {
+        peg->same_rank++;
+    }
+    else {
+        peg->same_rank = 1;
+    }
+    peg->distinct++;
+    if (n - peg->rank_pos[card.rank] < peg->distinct) {
+        peg->distinct = n - peg->rank_pos[card.rank];
+    }
+    peg->rank_pos[card.rank] = n;
+    peg->rank_sum[n + 1] = peg->rank_sum[n] + (1 << card.rank);
+
+    hand_append(&peg->cur_played, card);
+    peg->cur_count += rank_value[card.rank];
+}
+
 bool peg_hands(int nplayers,
                peg_state_t *peg,
                hand_t *hands[],
+               hand_t *crib,
+               card_t starter,
                peg_func_t select[],
                game_callback_func_t callback,
                void *cb_data) {
     assert(nplayers == 2);
-    assert(hands[0]->ncards == hands[1]->ncards);
-    uint ncards = hands[0]->ncards;
-    int bufsize = ncards * 5;
-    char buf1[bufsize], buf2[bufsize];
+    peg_start(peg, hands, crib, starter);
+    return peg_play_out(peg, select, callback, cb_data);
+}
 
-    copy_hand(peg->avail[0], hands[0]);
-    copy_hand(peg->avail[1], hands[1]);
+/* Start pegging hands[0] against hands[1] with peg, which must have been
+ * reset for hands of this size. crib holds hands[0]'s discards then
+ * hands[1]'s, as play_hand() deals them; crib may be NULL and starter
+ * CARD_NONE if they do not matter (e.g. for a strategy that sees both
+ * hands anyway).
+ */
+void peg_start(peg_state_t *peg, hand_t *hands[], hand_t *crib, card_t starter) {
+    assert(hands[0]->ncards == hands[1]->ncards);
+    assert(peg->avail[0].size >= hands[0]->ncards);
+
+    copy_hand(&peg->avail[0], hands[0]);
+    copy_hand(&peg->avail[1], hands[1]);
+    peg->starter = starter;
+    if (crib != NULL) {
+        assert(crib->ncards >= 4);
+        for (int p = 0; p < 2; p++) {
+            peg->discards[p][0] = crib->cards[2 * p];
+            peg->discards[p][1] = crib->cards[2 * p + 1];
+        }
+    }
 
-    log_debug("peg_hands(): hands[0]=%s, hands[1]=%s",
-              hand_str(buf1, bufsize, hands[0]),
-              hand_str(buf2, bufsize, hands[1]));
+    if (log_enabled(LOG_DEBUG)) {
+        int bufsize = hands[0]->ncards * 5;
+        char buf1[bufsize], buf2[bufsize];
+        log_debug("peg_hands(): hands[0]=%s, hands[1]=%s",
+                  hand_str(buf1, bufsize, hands[0]),
+                  hand_str(buf2, bufsize, hands[1]));
+    }
 
     // Start pegging from hands[0], aka player 0, aka avail[0]. This implies that
-    // player 1 (hands[1]) is the dealer.
-    int player = 1;
-    int other = 0;
+    // player 1 (hands[1]) is the dealer. (peg_next_turn() flips players
+    // before the first card.)
+    peg->player = 1;
+    peg->other = 0;
 
     // Keep track of which players are blocked, i.e. cannot play a card and keep
     // the count at 31 or lower.
-    bool blocked[2] = {false, false};
-    bool need_reset = false;
+    peg->blocked[0] = false;
+    peg->blocked[1] = false;
+    peg->need_reset = false;
+    peg->done = false;
+}
 
+/* Move on from the last play to the next player who has to choose a card
+ * (or say go), resetting the count on the way if need be. peg must not be
+ * done.
+ */
+void peg_next_turn(peg_state_t *peg) {
+    bool *blocked = peg->blocked;
     while (true) {
-        if (need_reset) {
+        if (peg->need_reset) {
             // We either hit 31, or both players are blocked (neither could
             // play without going over 31).
             assert(peg->num_rounds < MAX_ROUNDS);
-            peg->cards_played[peg->num_rounds] = peg->cur_played;
+            copy_hand(&peg->cards_played[peg->num_rounds], &peg->cur_played);
             peg->counts[peg->num_rounds] = peg->cur_count;
             peg->num_rounds++;
-            peg->cur_played = new_hand(ncards * 2);
-            peg->cur_count = 0;
-            blocked[player] = false;
-            blocked[other] = false;
-            need_reset = false;
+            peg_new_round(peg);
+            blocked[peg->player] = false;
+            blocked[peg->other] = false;
+            peg->need_reset = false;
         }
 
         // Flip to the other player ... unless they are blocked.
-        if (!(blocked[other])) {
-            other = player;
-            player ^= 1;
+        if (!(blocked[peg->other])) {
+            peg->other = peg->player;
+            peg->player ^= 1;
         }
 
-        uint player_left = peg->avail[player]->ncards;
-        uint other_left = peg->avail[other]->ncards;
+        int player = peg->player;
+        int other = peg->other;
+        uint player_left = peg->avail[player].ncards;
+        uint other_left = peg->avail[other].ncards;
         uint total_left = player_left + other_left;
 
         assert(total_left > 0);
@@ -349,7 +639,7 @@ bool peg_hands(int nplayers,
 
             if (blocked[other]) {
                 log_trace("  but player %d blocked: need reset", other);
-                need_reset = true;
+                peg->need_reset = true;
             }
             continue;
         }
@@ -359,49 +649,104 @@ bool peg_hands(int nplayers,
         if (blocked[player] && blocked[other] && total_left > 0) {
             log_trace("  both players blocked, still have %d cards left: need reset",
                       total_left);
-            need_reset = true;
+            peg->need_reset = true;
             continue;
         }
 
         assert(!blocked[player]);
+        return;
+    }
+}
 
-        // Current player selects a card to play -- or decides that they are blocked.
-        int selected = select[player](peg, player, other);
-        if (selected == -1) {
-            log_trace("  player %d says go (is blocked)", player);
-            if (!blocked[other]) {
-                log_trace("  player %d blocked: 1 point to player %d",
-                          player,
-                          other);
-                peg->points[other]++;
-                if (callback(cb_data, other, 1)) {
-                    return true;
-                }
-            }
-            else {
-                log_trace("  player %d blocked: no points to player %d (already blocked)",
-                          player,
-                          other);
+/* Play the card at position selected in the current player's available
+ * cards, or say go if selected is -1, and score the play. Returns true if
+ * callback says the game is over.
+ */
+bool peg_play_card(peg_state_t *peg,
+                   int selected,
+                   game_callback_func_t callback,
+                   void *cb_data) {
+    int player = peg->player;
+    int other = peg->other;
+    bool *blocked = peg->blocked;
+    uint other_left = peg->avail[other].ncards;
+    char buf[5];                        // for card_str() in trace messages
+
+    if (selected == -1) {
+        log_trace("  player %d says go (is blocked)", player);
+        if (peg->min_value[player] < 32 - peg->cur_count) {
+            peg->min_value[player] = 32 - peg->cur_count;
+        }
+        if (!blocked[other]) {
+            log_trace("  player %d blocked: 1 point to player %d",
+                      player,
+                      other);
+            peg->points[other]++;
+            if (callback(cb_data, other, 1)) {
+                return true;
             }
-            blocked[player] = true;
-            continue;
         }
+        else {
+            log_trace("  player %d blocked: no points to player %d (already blocked)",
+                      player,
+                      other);
+        }
+        blocked[player] = true;
+        return false;
+    }
 
-        // Play the selected card: move it from the player's 'avail' array to
-        // 'played' and 'cur_played', and update the current count.
-        assert(selected >= 0);
-        assert(selected < peg->avail[player]->ncards);
-        card_t card = peg->avail[player]->cards[selected];
-        hand_delete(peg->avail[player], selected);
-        hand_append(peg->cur_played, card);
-        peg->cur_count += rank_value[card.rank];
-        assert(peg->cur_count <= 31);       // make sure select() does not break the rules
-
-        // Anything interesting about the count?
-        if (peg->cur_count == 15) {
+    // Play the selected card: move it from the player's 'avail' array to
+    // 'played' and 'cur_played', and update the current count.
+    assert(selected >= 0);
+    assert(selected < peg->avail[player].ncards);
+    card_t card = peg->avail[player].cards[selected];
+    uint pair_points = peg_pair_points(peg, card);
+    uint run_points = peg_run_points(peg, card);
+    hand_delete(&peg->avail[player], selected);
+    peg_append(peg, card);
+    assert(peg->cur_count <= 31);       // make sure select() does not break the rules
+
+    // Anything interesting about the count?
+    if (peg->cur_count == 15) {
+        log_trace("  player %d played card %s, cur_count=%d: 2 points to player %d",
+                  player,
+                  card_str(buf, card),
+                  peg->cur_count,
+                  player);
+        peg->points[player] += 2;
+        if (callback(cb_data, player, 2)) {
+            return true;
+        }
+    }
+    else if (peg->cur_count == 31) {
+        if (blocked[other]) {
+            log_trace("  player %d played card %s, cur_count=%d: "
+                      "1 point to player %d because player %d is blocked",
+                      player,
+                      card_str(buf, card),
+                      peg->cur_count,
+                      player,
+                      other);
+            peg->points[player] += 1;
+            if (callback(cb_data, player, 1)) {
+                return true;
+            }
+        }
+        else if (other_left == 0 && peg->avail[player].ncards == 0) {
+            log_trace("  player %d played card %s, cur_count=%d: 1 point to player %d for last card",
+                      player,
+                      card_str(buf, card),
+                      peg->cur_count,
+                      player);
+            peg->points[player] += 1;
+            if (callback(cb_data, player, 1)) {
+                return true;
+            }
+        }
+        else {
             log_trace("  player %d played card %s, cur_count=%d: 2 points to player %d",
                       player,
-                      card_str(buf1, card),
+                      card_str(buf, card),
                       peg->cur_count,
                       player);
             peg->points[player] += 2;
@@ -409,97 +754,101 @@ bool peg_hands(int nplayers,
                 return true;
             }
         }
-        else if (peg->cur_count == 31) {
-            if (blocked[other]) {
-                log_trace("  player %d played card %s, cur_count=%d: "
-                          "1 point to player %d because player %d is blocked",
-                          player,
-                          card_str(buf1, card),
-                          peg->cur_count,
-                          player,
-                          other);
-                peg->points[player] += 1;
-                if (callback(cb_data, player, 1)) {
-                    return true;
-                }
-            }
-            else if (other_left == 0 && peg->avail[player]->ncards == 0) {
-                log_trace("  player %d played card %s, cur_count=%d: 1 point to player %d for last card",
-                          player,
-                          card_str(buf1, card),
-                          peg->cur_count,
-                          player);
-                peg->points[player] += 1;
-                if (callback(cb_data, player, 1)) {
-                    return true;
-                }
-            }
-            else {
-                log_trace("  player %d played card %s, cur_count=%d: 2 points to player %d",
-                          player,
-                          card_str(buf1, card),
-                          peg->cur_count,
-                          player);
-                peg->points[player] += 2;
-                if (callback(cb_data, player, 2)) {
-                    return true;
-                }
-            }
 
-            if (peg->avail[player]->ncards > 0) {
-                need_reset = true;
-            }
-        }
-        else {
-            log_trace("  player %d played card %s, cur_count=%d",
-                      player,
-                      card_str(buf1, card),
-                      peg->cur_count);
+        if (peg->avail[player].ncards > 0) {
+            peg->need_reset = true;
         }
+    }
+    else {
+        log_trace("  player %d played card %s, cur_count=%d",
+                  player,
+                  card_str(buf, card),
+                  peg->cur_count);
+    }
+
+
+    log_trace("  need_reset=%d, points={%d, %d}",
+              peg->need_reset,
+              peg->points[0],
+              peg->points[1]);
 
+    // Check for M-of-a-kind.
+    if (pair_points > 0) {
+        log_trace("  found %d-of-a-kind, %d points to player %d",
+                  peg->same_rank,
+                  pair_points,
+                  player);
+    }
+    peg->points[player] += pair_points;
+    if (callback(cb_data, player, pair_points)) {
+        return true;
+    }
 
-        log_trace("  need_reset=%d, points={%d, %d}",
-                  need_reset,
-                  peg->points[0],
-                  peg->points[1]);
+    // Check for runs of M.
+    if (run_points > 0) {
+        log_trace("  found run of %d: %d points to player %d",
+                  run_points,
+                  run_points,
+                  player);
+    }
+    peg->points[player] += run_points;
+    if (callback(cb_data, player, run_points)) {
+        return true;
+    }
 
-        // Check for M-of-a-kind.
-        uint pair_points = peg_count_pairs(peg, player);
-        peg->points[player] += pair_points;
-        if (callback(cb_data, player, pair_points)) {
+    // Check for last card.
+    if (other_left == 0 && peg->avail[player].ncards == 0) {
+        log_trace("  player %d played last card: 1 point, done pegging", player);
+        peg->points[player]++;
+        peg->done = true;
+        if (callback(cb_data, player, 1)) {
             return true;
         }
+    }
+    return false;
+}
 
-        // Check for runs of M.
-        uint run_points = peg_count_runs(peg, player);
-        peg->points[player] += run_points;
-        if (callback(cb_data, player, run_points)) {
-            return true;
+/* Peg the rest of the hand from peg, as set up by peg_start() or left by
+ * peg_play_card(), with the given strategies. Returns true if callback
+ * says the game is over.
+ */
+bool peg_play_out(peg_state_t *peg,
+                  peg_func_t select[],
+                  game_callback_func_t callback,
+                  void *cb_data) {
+    while (!peg->done) {
+        int nrounds = peg->num_rounds;
+        peg_next_turn(peg);
+        if (peg->num_rounds > nrounds) {
+            PROBE2(peg__reset, nrounds, peg->counts[nrounds]);
         }
 
-        // Check for last card.
-        if (other_left == 0 && peg->avail[player]->ncards == 0) {
-            log_trace("  player %d played last card: 1 point, done pegging", player);
-            peg->points[player]++;
-            if (callback(cb_data, player, 1)) {
-                return true;
-            }
-            break;
+        // Current player selects a card to play -- or decides that they are blocked.
+        int player = peg->player;
+        int selected;
+        phase_time(PHASE_PEG_FUNC,
+                   selected = select[player](peg, player, peg->other));
+        int card = (selected == -1) ? -1 : card_code(peg->avail[player].cards[selected]);
+        uint points = peg->points[player];
+        bool game_over = peg_play_card(peg, selected, callback, cb_data);
+        PROBE4(peg__play, player, card, peg->cur_count, peg->points[player] - points);
+        if (game_over) {
+            return true;
         }
     }
 
     assert(peg->num_rounds < MAX_ROUNDS);
-    peg->cards_played[peg->num_rounds] = peg->cur_played;
+    copy_hand(&peg->cards_played[peg->num_rounds], &peg->cur_played);
     peg->counts[peg->num_rounds] = peg->cur_count;
     peg->num_rounds++;
     for (int i = peg->num_rounds; i < MAX_ROUNDS; i++) {
         peg->counts[i] = -1;
-        peg->cards_played[i] = NULL;
+        hand_truncate(&peg->cards_played[i]);
     }
-    peg->cur_played = NULL;
+    hand_truncate(&peg->cur_played);
 
-    assert(peg->avail[0]->ncards == 0);
-    assert(peg->avail[1]->ncards == 0);
+    assert(peg->avail[0].ncards == 0);
+    assert(peg->avail[1].ncards == 0);
 
     log_debug("pegging done: %d points to player 0, %d points to player 1",
               peg->points[0],
@@ -507,23 +856,23 @@ bool peg_hands(int nplayers,
     return false;
 }
 
-
-/* Add the starter card to a hand, sort the hand in-place, and set
+/* Add the starter card to a sorted hand, keeping it sorted, and set
  * hand->starter to record where position of 'starter' in 'hand'.
  */
 void add_starter(hand_t *hand, card_t starter) {
-    hand_append(hand, starter);
-    sort_cards(hand->ncards, hand->cards);
-    hand->starter = -1;
-    for (int i = 0; i < hand->ncards; i++) {
-        if (card_cmp(&hand->cards[i], &starter) == 0) {
-            hand->starter = i;
-            break;
-        }
-    }
+    hand->starter = hand_insert_sorted(hand, starter);
     assert(hand->starter >= 0);
 }
 
+/* Add the starter card to the end of a hand, and set hand->starter to
+ * record its position. Unlike add_starter(), this does not sort the hand:
+ * scoring does not care about order.
+ */
+void append_starter(hand_t *hand, card_t starter) {
+    hand_append(hand, starter);
+    hand->starter = hand->ncards - 1;
+}
+
 bool update_scores(void *data, int player, uint points) {
     gamestate_t *game_state = data;
     playername_t player_name = game_state->player_name[player];
@@ -539,6 +888,40 @@ bool update_scores(void *data, int player, uint points) {
     return false;
 }
 
+/* Add starter to each hand and the crib, and score all three (after
+ * pegging). Returns true if that ends the game.
+ */
+static bool score_show(gamestate_t *game_state,
+                       hand_t *hands[],
+                       hand_t *crib,
+                       card_t starter) {
+    append_starter(hands[0], starter);
+    append_starter(hands[1], starter);
+    append_starter(crib, starter);
+
+    score_t score;
+
+    score = score_hand(hands[0]);
+    score_log("hands[0] scoring", score);
+    if (update_scores(game_state, 0, score.total)) {
+        return true;
+    }
+
+    score = score_hand(hands[1]);
+    score_log("hands[1] scoring", score);
+    if (update_scores(game_state, 1, score.total)) {
+        return true;
+    }
+
+    score = score_hand(crib);
+    score_log("crib scoring ", score);
+    if (update_scores(game_state, 1, score.total)) {
+        return true;
+    }
+
+    return false;
+}
+
 bool evaluate_hands(gamestate_t *game_state,
                     int nplayers,
                     hand_t *hands[],
@@ -558,62 +941,45 @@ bool evaluate_hands(gamestate_t *game_state,
         game_state->strategy[pname[1]].peg_func,
     };
 
-    peg_state_t *peg = new_peg_state(hands[0]->ncards);
-    bool done = peg_hands(nplayers, peg, hands, peg_funcs, update_scores, game_state);
-    peg_state_free(peg);
+    peg_state_t *peg = &game_state->peg;
+    peg_state_reset(peg, hands[0]->ncards);
+    bool done;
+    phase_time(PHASE_PEG,
+               done = peg_hands(nplayers, peg, hands, crib, starter,
+                                peg_funcs, update_scores, game_state));
     if (done) {
         return true;
     }
 
-    // Add starter to each hand and the crib, and score all three.
-    add_starter(hands[0], starter);
-    add_starter(hands[1], starter);
-    add_starter(crib, starter);
-
-    score_t score;
-
-    score = score_hand(hands[0]);
-    score_log("hands[0] scoring", score);
-    if (update_scores(game_state, 0, score.total)) {
-        return true;
-    }
-
-    score = score_hand(hands[1]);
-    score_log("hands[1] scoring", score);
-    if (update_scores(game_state, 1, score.total)) {
-        return true;
-    }
-
-    score = score_hand(crib);
-    score_log("crib scoring ", score);
-    if (update_scores(game_state, 1, score.total)) {
-        return true;
-    }
-
-    return false;
+    phase_time(PHASE_SHOW, done = score_show(game_state, hands, crib, starter));
+    return done;
 }
 
+/* Play one hand using the cards in deal. rng is only used by discard
+ * strategies: the cards (including the starter) are all in deal.
+ */
 bool play_hand(gamestate_t *game_state,
-               deck_t *deck) {
+               deal_t *deal,
+               rng_t *rng) {
     int nplayers = 2;
-    int ncards = 6;
+    int ncards = DEAL_HAND_CARDS;
 
-    hand_t *hands[2];
-    hands[0] = new_hand(ncards);
-    hands[1] = new_hand(ncards);
-    hand_t *crib = new_hand(5);
+    hand_t hand_buf[2], crib_buf;
+    hand_t *hands[2] = {&hand_buf[0], &hand_buf[1]};
+    hand_t *crib = &crib_buf;
+    hand_init(hands[0], ncards);
+    hand_init(hands[1], ncards);
+    hand_init(crib, 5);
 
-    // Deal the hands.
-    shuffle_deck(deck);
-    int deck_offset = 0;
+    playername_t *pname = game_state->player_name;
+    PROBE3(hand__start, pname[1], game_state->score[PLAYER_A], game_state->score[PLAYER_B]);
+
+    // Pick up the hands.
+    phase_begin(PHASE_DISCARD);
     for (int i = 0; i < ncards; i++) {
-        hand_append(hands[0], deck->cards[deck_offset++]);
-        hand_append(hands[1], deck->cards[deck_offset++]);
+        hand_append(hands[0], deal->cards[i]);
+        hand_append(hands[1], deal->cards[ncards + i]);
     }
-    assert(deck->ncards - deck_offset == 40);
-    assert(deck_offset == ncards * nplayers);
-
-    playername_t *pname = game_state->player_name;
 
     // Discard cards using configured strategies. Have to sort first because
     // that's part of the contract with discard strategy functions.
@@ -622,7 +988,13 @@ bool play_hand(gamestate_t *game_state,
               "hands[0] after dealing",
               hands[0]->ncards,
               hands[0]->cards);
-    game_state->strategy[pname[0]].discard_func(hands[0], crib);
+    strategy_t *strategy = &game_state->strategy[pname[0]];
+    discard_ctx_t ctx = {dealer: false, rng: rng, data: strategy->discard_data};
+    phase_time(PHASE_DISCARD_FUNC, strategy->discard_func(hands[0], crib, &ctx));
+    PROBE3(discard,
+           0,
+           card_code(crib->cards[crib->ncards - 2]),
+           card_code(crib->cards[crib->ncards - 1]));
     log_cards(LOG_DEBUG,
               "hands[0] after discard",
               hands[0]->ncards,
@@ -633,7 +1005,13 @@ bool play_hand(gamestate_t *game_state,
               "hands[1] after dealing",
               hands[1]->ncards,
               hands[1]->cards);
-    game_state->strategy[pname[1]].discard_func(hands[1], crib);
+    strategy = &game_state->strategy[pname[1]];
+    ctx = (discard_ctx_t) {dealer: true, rng: rng, data: strategy->discard_data};
+    phase_time(PHASE_DISCARD_FUNC, strategy->discard_func(hands[1], crib, &ctx));
+    PROBE3(discard,
+           1,
+           card_code(crib->cards[crib->ncards - 2]),
+           card_code(crib->cards[crib->ncards - 1]));
     log_cards(LOG_DEBUG,
               "hands[1] after discard",
               hands[1]->ncards,
@@ -643,13 +1021,13 @@ bool play_hand(gamestate_t *game_state,
               "crib after discard    ",
               crib->ncards,
               crib->cards);
+    phase_end(PHASE_DISCARD);
 
     // Turn up the starter card.
-    int starter_idx = rand() % (deck->ncards - deck_offset);
-    starter_idx += deck_offset;
-    card_t starter = deck->cards[starter_idx];
+    card_t starter = deal->cards[DEAL_STARTER];
     char buf[5];
-    log_debug("starter: deck[%d] = %s", starter_idx, card_str(buf, starter));
+    log_debug("starter: %s", card_str(buf, starter));
+    PROBE2(starter, card_code(starter), pname[1]);
 
     // Evaluate the results (including pegging).
     bool done = evaluate_hands(game_state,
@@ -657,34 +1035,35 @@ bool play_hand(gamestate_t *game_state,
                                hands,
                                crib,
                                starter);
-
-    free(hands[0]);
-    free(hands[1]);
-    free(crib);
+    PROBE3(hand__end, done, game_state->score[PLAYER_A], game_state->score[PLAYER_B]);
 
     return done;
 }
 
-playername_t play_game(deck_t *deck) {
-    gamestate_t game_state = gamestate_init();
+/* Play a complete game between PLAYER_A and PLAYER_B, using
+ * strategy[PLAYER_A] and strategy[PLAYER_B] respectively. Draws all
+ * random numbers (deals, first dealer, random strategies) from rng. A
+ * game is thus fully determined by the strategies, the order of deck,
+ * and the stream that rng was initialized to. Deals are generated
+ * DEAL_BATCH at first and DEAL_REFILL at a time after that.
+ */
+playername_t play_game(strategy_t strategy[2], deck_t *deck, rng_t *rng) {
+    deal_t deals[DEAL_BATCH];
+    int ndeals = 0;
+    int next_deal = 0;
 
-    // Players A and B have the same naive pegging strategy.
-    // But Player A has a better discard strategy.
-    game_state.strategy[PLAYER_A] = (strategy_t) {
-        peg_func: peg_select_low,
-        discard_func: discard_simple,
-    };
-    game_state.strategy[PLAYER_B] = (strategy_t) {
-        peg_func: peg_select_low,
-        discard_func: discard_simple,
-    };
+    phase_begin(PHASE_GAME);
+    gamestate_t game_state = gamestate_init();
+    game_state.strategy[PLAYER_A] = strategy[PLAYER_A];
+    game_state.strategy[PLAYER_B] = strategy[PLAYER_B];
 
     // Pick the first dealer. Note that this decision will be flipped
     // as soon as we start the loop below, but whatever. It's still
     // randomized.
-    playername_t dealer = (playername_t) (rand() % 2);
+    playername_t dealer = (playername_t) rng_below(rng, 2);
     game_state.player_name[1] = dealer;
     game_state.player_name[0] = dealer ^ 1;
+    PROBE1(game__start, dealer ^ 1);
 
     bool done = false;
     int num_hands = 0;
@@ -694,29 +1073,36 @@ playername_t play_game(deck_t *deck) {
         game_state.player_name[0] ^= 1;
         game_state.player_name[1] ^= 1;
 
-        done = play_hand(&game_state, deck);
+        if (next_deal == ndeals) {
+            ndeals = (num_hands == 0) ? DEAL_BATCH : DEAL_REFILL;
+            next_deal = 0;
+            phase_time(PHASE_DEAL, deal_batch(deck, rng, ndeals, deals));
+        }
+        phase_time(PHASE_HAND, done = play_hand(&game_state, &deals[next_deal++], rng));
         num_hands++;
-        stringbuilder_t winner_sb;
-        sb_init(&winner_sb, 20);
         if (done) {
             assert(game_state.winner == PLAYER_A ||
                    game_state.winner == PLAYER_B);
             winner_name = playername_as_char(game_state.winner);
             assert(winner_name == 'a' || winner_name == 'b');
-            sb_printf(&winner_sb,
-                      "winner=%c",
-                      winner_name);
+            log_info("after %d hand(s): scores={a: %d, b: %d}, winner=%c",
+                     num_hands,
+                     game_state.score[PLAYER_A],
+                     game_state.score[PLAYER_B],
+                     winner_name);
         }
         else {
-            sb_append(&winner_sb, "no winner yet");
+            log_info("after %d hand(s): scores={a: %d, b: %d}, no winner yet",
+                     num_hands,
+                     game_state.score[PLAYER_A],
+                     game_state.score[PLAYER_B]);
         }
-
-        log_info("after %d hand(s): scores={a: %d, b: %d}, %s",
-                 num_hands,
-                 game_state.score[PLAYER_A],
-                 game_state.score[PLAYER_B],
-                 sb_as_string(&winner_sb));
-        sb_close(&winner_sb);
     }
+    phase_end(PHASE_GAME);
+    PROBE4(game__end,
+           game_state.winner,
+           game_state.score[PLAYER_A],
+           game_state.score[PLAYER_B],
+           num_hands);
     return game_state.winner;
 }
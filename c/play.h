@@ -16,11 +16,18 @@ typedef struct _peg_state peg_state_t;
 // card from avail to played, updating count, whatever.
 typedef int (*peg_func_t)(peg_state_t * peg, int player, int other);
 
+// What a discard strategy knows about the situation besides its own cards.
+typedef struct {
+    bool dealer;                // true if the crib belongs to this player
+    rng_t *rng;                 // strategies that need randomness use this
+    void *data;                 // the strategy's discard_data
+} discard_ctx_t;
+
 // discard_func_t implements a discard strategy: one call selects two
 // cards in 'hand' and appends them to 'crib'. Caller is responsible
 // for ensuring that 'crib' is big enough to hold the additional
 // cards.
-typedef void (*discard_func_t)(hand_t *hand, hand_t *crib);
+typedef void (*discard_func_t)(hand_t *hand, hand_t *crib, discard_ctx_t *ctx);
 
 typedef enum {
     PLAYER_A = 0,
@@ -31,8 +38,71 @@ typedef enum {
 typedef struct {
     peg_func_t peg_func;
     discard_func_t discard_func;
+    void *discard_data;         // passed to discard_func in ctx->data
 } strategy_t;
 
+#define MAX_ROUNDS 3
+
+// Everything about a hand being pegged. It is flat -- no pointers, every
+// array inline -- so it can be reset in place and reused for every hand of
+// a simulation, and a copy (plain assignment or memcpy()) is a complete,
+// independent pegging position: search strategies can clone it, play on
+// with peg_play_card() and peg_play_out(), and throw the copy away.
+typedef struct _peg_state {
+    // Keep track of the number of times that the pegging count hits or exceeds
+    // 31, and the highest count that we reach each time. With 2 players, 4
+    // cards per hand, both players having only value 10 cards (10, J, Q, K),
+    // then they will top out at 30, 30, 20. Thus the maximum possible number of
+    // counts is 3.
+    uint num_rounds;
+    hand_t cur_played;                  // list of cards played on current round
+    hand_t cards_played[MAX_ROUNDS];    // list of cards played on each round
+    int counts[MAX_ROUNDS];             // count reached on each round
+
+    // The current count, i.e. sum of the cards played since the count was last
+    // reset to zero.
+    uint cur_count;
+
+    uint points[2];
+    hand_t avail[2];
+
+    // Whose turn it is: player is the one to play (or say go) next, as
+    // seen by a peg_func_t. Players are blocked once they have said go
+    // for the current count.
+    int player;
+    int other;
+    bool blocked[2];
+    bool need_reset;                    // count must go back to 0 first
+    bool done;                          // last card has been played
+
+    // What each player knows besides their own cards and the cards played
+    // (set by peg_start()): the starter, and the two cards they discarded
+    // to the crib. CARD_NONE where not known.
+    card_t starter;
+    card_t discards[2][2];
+
+    // Every card that player p still holds is worth at least min_value[p]:
+    // once a player has said go at count c, none of their cards fit
+    // (value > 31 - c), and they only ever hold fewer cards from then on.
+    uint8_t min_value[2];
+
+    // What the current round looks like to the scorer, kept up to date as
+    // cards are played, so that the points for a card can be found
+    // without rescanning cur_played (see peg_card_points()):
+    //  - rank_pos[r]: position in cur_played of the last card of rank r,
+    //    or -1
+    //  - same_rank: how many cards at the end of cur_played have the rank
+    //    of the last one
+    //  - distinct: length of the longest tail of cur_played with no two
+    //    cards of the same rank (only such a tail can be a run)
+    //  - rank_sum[i]: sum of 1 << rank over cur_played[0 .. i-1]; within
+    //    a distinct tail, a difference of two sums is the rank bitmask
+    int8_t rank_pos[14];
+    uint8_t same_rank;
+    uint8_t distinct;
+    uint16_t rank_sum[HAND_MAX_CARDS + 1];
+} peg_state_t;
+
 typedef struct {
     // Map player id (0 = nondealer, 1 = dealer) to player name (PLAYER_A,
     // PLAYER_B). This cycles with every hand: if PLAYER_A is 0 (nondealer) on
@@ -52,44 +122,54 @@ typedef struct {
     // PLAYER_NOBODY if no winner yet, otherwise PLAYER_A or PLAYER_B
     // for the player who just hit 121
     playername_t winner;
+
+    // Pegging state, reset for every hand.
+    peg_state_t peg;
 } gamestate_t;
 
 gamestate_t gamestate_init();
 
 void add_starter(hand_t *hand, card_t starter);
+void append_starter(hand_t *hand, card_t starter);
 bool play_hand(gamestate_t *game_state,
-               deck_t *deck);
-playername_t play_game(deck_t *deck);
+               deal_t *deal,
+               rng_t *rng);
 
-void discard_simple(hand_t *hand, hand_t *crib);
-void discard_random(hand_t *hand, hand_t *crib);
+// play_game() generates DEAL_BATCH deals up front, and DEAL_REFILL more
+// at a time if the game goes on. Games between sensible strategies take
+// 8 to 11 hands (9 on average), so few deals go to waste.
+#define DEAL_BATCH 8
+#define DEAL_REFILL 2
 
-#define MAX_ROUNDS 3
+playername_t play_game(strategy_t strategy[2], deck_t *deck, rng_t *rng);
 
-typedef struct _peg_state {
-    // Keep track of the number of times that the pegging count hits or exceeds
-    // 31, and the highest count that we reach each time. With 2 players, 4
-    // cards per hand, both players having only value 10 cards (10, J, Q, K),
-    // then they will top out at 30, 30, 20. Thus the maximum possible number of
-    // counts is 3.
-    uint num_rounds;
-    hand_t *cur_played;                 // list of cards played on current round
-    hand_t *cards_played[MAX_ROUNDS];   // list of cards played on each round
-    int counts[MAX_ROUNDS];             // count reached on each round
+void discard_simple(hand_t *hand, hand_t *crib, discard_ctx_t *ctx);
+void discard_random(hand_t *hand, hand_t *crib, discard_ctx_t *ctx);
+void discard_expected(hand_t *hand, hand_t *crib, discard_ctx_t *ctx);
+void discard_crib(hand_t *hand, hand_t *crib, discard_ctx_t *ctx);
 
-    // The current count, i.e. sum of the cards played since the count was last
-    // reset to zero.
-    uint cur_count;
+// The ways to discard 2 cards out of 6, by position in the hand.
+#define DISCARD_OPTIONS 15
+extern const uint8_t discard_pairs[DISCARD_OPTIONS][2];
 
-    uint points[2];
-    hand_t *avail[2];
-} peg_state_t;
+void discard_values(hand_t *hand, bool dealer, bool with_crib, float value[]);
+int discard_best_option(float value[]);
+void discard_cards(hand_t *hand, hand_t *crib, card_t discards[2]);
+discard_func_t discard_func_by_name(const char *name);
+bool discard_func_deterministic(discard_func_t func);
 
+void peg_state_reset(peg_state_t *peg, int ncards);
 peg_state_t *new_peg_state(int ncards);
 void peg_state_free(peg_state_t *peg);
 
 int peg_select_low(peg_state_t *peg, int player, int other);
 int peg_select_high(peg_state_t *peg, int player, int other);
+int peg_select_greedy(peg_state_t *peg, int player, int other);
+peg_func_t peg_func_by_name(const char *name);
+
+uint peg_pair_points(peg_state_t *peg, card_t card);
+uint peg_run_points(peg_state_t *peg, card_t card);
+uint peg_card_points(peg_state_t *peg, card_t card);
 
 bool evaluate_hands(gamestate_t *game_state,
                     int nplayers,
@@ -99,8 +179,20 @@ bool evaluate_hands(gamestate_t *game_state,
 bool peg_hands(int nplayers,
                peg_state_t *peg,
                hand_t *hands[],
+               hand_t *crib,
+               card_t starter,
                peg_func_t select[],
                game_callback_func_t callback,
                void *cb_data);
+void peg_start(peg_state_t *peg, hand_t *hands[], hand_t *crib, card_t starter);
+void peg_next_turn(peg_state_t *peg);
+bool peg_play_card(peg_state_t *peg,
+                   int selected,
+                   game_callback_func_t callback,
+                   void *cb_data);
+bool peg_play_out(peg_state_t *peg,
+                  peg_func_t select[],
+                  game_callback_func_t callback,
+                  void *cb_data);
 
 #endif
@@ -0,0 +1,70 @@
+#ifndef _PROBES_H
+#define _PROBES_H
+
+// Static tracepoints (USDT probes) for watching a simulation from outside
+// with bpftrace, perf, systemtap, etc. They use <sys/sdt.h>, so each probe
+// is a single nop plus a note in the binary until a tracer attaches to it:
+// e.g.
+//
+//   bpftrace -e 'usdt:build/cribsim:cribsim:game__end { @[arg0] = count(); }'
+//   perf probe -x build/cribsim sdt_cribsim:peg__play
+//
+// They are only built in with make PROBES=1, which needs sys/sdt.h
+// (systemtap's sdt-devel / systemtap-sdt-dev); otherwise the probe macros
+// compile to nothing at all. Arguments are only evaluated when the probes
+// are built in, so they must not have side effects.
+//
+// Players are 0 (non-dealer) and 1 (dealer), as in play_hand(), unless
+// noted. Cards are card_code()s: rank << 4 | suit.
+//
+// Provider "cribsim", probes and their arguments:
+//
+// game__start(dealer)
+//     play_game() is starting: dealer deals the first hand (playername_t:
+//     0 for a, 1 for b).
+// game__end(winner, score_a, score_b, nhands)
+//     play_game() is done: winner is a playername_t.
+// hand__start(dealer, score_a, score_b)
+//     play_hand() has a deal: dealer is a playername_t, scores are before
+//     this hand.
+// starter(card, dealer)
+//     play_hand() turned up the starter card (after discarding).
+// hand__end(game_over, score_a, score_b)
+//     play_hand() is done: game_over is 1 if someone reached 121.
+// discard(player, card1, card2)
+//     player's discard strategy put card1 and card2 in the crib.
+// peg__play(player, card, count, points)
+//     In peg_play_out(), player played card (-1 for go), making the count
+//     count and scoring points.
+// peg__reset(round, count)
+//     In peg_play_out(), the count was reset after round (0-based), which
+//     ended at count.
+// score__hand(hand, ncards, total, fifteens, pairs, runs, flush, right_jack)
+//     score_hand() scored hand (a hand_t *, including the starter if any).
+//     Fires for every hand scored, including discard evaluation.
+
+#ifdef CRIBSIM_PROBES
+
+#include <sys/sdt.h>
+
+#define PROBE1(name, a1) DTRACE_PROBE1(cribsim, name, a1)
+#define PROBE2(name, a1, a2) DTRACE_PROBE2(cribsim, name, a1, a2)
+#define PROBE3(name, a1, a2, a3) DTRACE_PROBE3(cribsim, name, a1, a2, a3)
+#define PROBE4(name, a1, a2, a3, a4) DTRACE_PROBE4(cribsim, name, a1, a2, a3, a4)
+#define PROBE8(name, a1, a2, a3, a4, a5, a6, a7, a8) \
+    DTRACE_PROBE8(cribsim, name, a1, a2, a3, a4, a5, a6, a7, a8)
+
+#else
+
+// Without probes, the arguments are still type-checked (and count as used),
+// but never evaluated.
+#define PROBE1(name, a1) ((void) sizeof(a1))
+#define PROBE2(name, a1, a2) (PROBE1(name, a1), (void) sizeof(a2))
+#define PROBE3(name, a1, a2, a3) (PROBE2(name, a1, a2), (void) sizeof(a3))
+#define PROBE4(name, a1, a2, a3, a4) (PROBE3(name, a1, a2, a3), (void) sizeof(a4))
+#define PROBE8(name, a1, a2, a3, a4, a5, a6, a7, a8) \
+    (PROBE4(name, a1, a2, a3, a4), PROBE4(name, a5, a6, a7, a8))
+
+#endif
+
+#endif
@@ -0,0 +1,48 @@
+#include <assert.h>
+
+#include "rng.h"
+
+#define GOLDEN_GAMMA 0x9e3779b97f4a7c15ULL
+
+/* Bijective 64-bit mixing function (the splitmix64 finalizer). */
+static inline uint64_t mix64(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+/* Initialize rng to the start of the stream identified by (seed, stream). */
+void rng_init(rng_t *rng, uint64_t seed, uint64_t stream) {
+    rng->key = mix64(seed ^ mix64(stream + GOLDEN_GAMMA));
+    rng->counter = 0;
+}
+
+/* Jump directly to value number 'counter' of the current stream. */
+void rng_seek(rng_t *rng, uint64_t counter) {
+    rng->counter = counter;
+}
+
+/* Return the next 64 random bits from rng. The key is mixed in twice so
+ * that streams with different keys are not shifted copies of each other.
+ */
+uint64_t rng_next(rng_t *rng) {
+    uint64_t x = rng->counter++ ^ rng->key;
+    return mix64(mix64(x) + rng->key);
+}
+
+/* Return a uniformly distributed integer in [0, bound), without the
+ * modulo bias of 'rng_next() % bound' (Lemire's multiply-and-reject).
+ */
+uint32_t rng_below(rng_t *rng, uint32_t bound) {
+    assert(bound > 0);
+    uint64_t m = (uint64_t) (uint32_t) rng_next(rng) * bound;
+    uint32_t low = (uint32_t) m;
+    if (low < bound) {
+        uint32_t threshold = -bound % bound;
+        while (low < threshold) {
+            m = (uint64_t) (uint32_t) rng_next(rng) * bound;
+            low = (uint32_t) m;
+        }
+    }
+    return (uint32_t) (m >> 32);
+}
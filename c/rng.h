@@ -0,0 +1,21 @@
+#ifndef _RNG_H
+#define _RNG_H
+
+#include <stdint.h>
+
+// rng_t is a counter-based random number generator: value number N of a
+// stream is a pure function of (key, N). Streams are keyed by (seed,
+// stream id) -- e.g. (run seed, game index) -- so any game of a run can be
+// reproduced without simulating the games before it, and every thread can
+// own its generator without sharing state.
+typedef struct {
+    uint64_t key;               // derived from (seed, stream)
+    uint64_t counter;           // number of values drawn so far
+} rng_t;
+
+void rng_init(rng_t *rng, uint64_t seed, uint64_t stream);
+void rng_seek(rng_t *rng, uint64_t counter);
+uint64_t rng_next(rng_t *rng);
+uint32_t rng_below(rng_t *rng, uint32_t bound);
+
+#endif
@@ -1,11 +1,17 @@
+#define _POSIX_C_SOURCE 200809L    // for pthread_once()
+
 #include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "cards.h"
-#include "log.h"
+#include "logging.h"
+#include "probes.h"
 #include "score.h"
 #include "stringbuilder.h"
-#include "twiddle.h"
 
 bool score_starter_jack(card_t starter,
                         game_callback_func_t callback,
@@ -19,96 +25,136 @@ bool score_starter_jack(card_t starter,
     return callback(cb_data, player, points);
 }
 
-typedef struct {
-    hand_t *hand;
-    uint num_15s;
-} count_data_t;
-
-/* Examine a single subset of a hand, counting whether it sums to 15. */
-void visit_count_15s(int ncards, int indexes[], void *_data) {
-    count_data_t *data = (count_data_t *) _data;
-    uint sum = 0;
-    for (int i = 0; i < ncards; i++) {
-        sum += rank_value[data->hand->cards[indexes[i]].rank];
-    }
-    if (sum == 15) {
-        data->num_15s++;
+/* Compute the rank and suit histogram of a hand (which might have any
+ * number of cards, in any order).
+ */
+void hand_hist(hand_hist_t *hist, hand_t *hand) {
+    memset(hist, 0, sizeof(hand_hist_t));
+    hist->starter_suit = SUIT_NONE;
+    for (int i = 0; i < hand->ncards; i++) {
+        card_t card = hand->cards[i];
+        hist->ranks[card.rank]++;
+        if (i == hand->starter) {
+            hist->starter_suit = card.suit;
+        }
+        else {
+            hist->suits[card.suit]++;
+            hist->nsuited++;
+        }
     }
 }
 
-uint count_15s(hand_t *hand) {
-    count_data_t data = {hand: hand, num_15s: 0};
-    for (int subset_len = hand->ncards; subset_len >= 2; subset_len--) {
-        iter_combos(hand->ncards, subset_len, visit_count_15s, &data);
+/* Count the subsets of a hand that add up to 15. This is a subset-sum
+ * over ranks: ways[s] is the number of subsets of the ranks seen so far
+ * that add up to s, and taking j of the n cards of one rank can be done
+ * in C(n, j) ways.
+ */
+uint hist_15s(hand_hist_t *hist) {
+    uint ways[16] = {1};
+    for (int rank = RANK_JOKER; rank <= RANK_KING; rank++) {
+        uint n = hist->ranks[rank];
+        uint value = rank_value[rank];
+        if (n == 0) {
+            continue;
+        }
+        // Sums below value cannot change (jokers are worth 0 and double
+        // everything).
+        for (int sum = 15; sum >= (int) value; sum--) {
+            uint total = ways[sum];
+            uint combos = 1;
+            for (uint j = 1; j <= n && j * value <= sum; j++) {
+                combos = combos * (n - j + 1) / j;
+                total += combos * ways[sum - j * value];
+            }
+            ways[sum] = total;
+        }
     }
-    return data.num_15s;
+    return ways[15];
 }
 
-uint count_pairs(hand_t *hand) {
-    // Search for pairs.
-    //
-    //  2♦ 3♥ 3♠ 5♠ -> 1 pair
-    //  2♦ 2♥ 5♣ 5♠ -> 2 pairs
-    //  2♦ 2♥ 2♠ 5♠ -> 3 pairs
-    uint ncards = hand->ncards;
-    card_t *cards = hand->cards;
-    int num_pairs = 0;
-    for (int i = 0; i < ncards - 1; i++) {
-        for (int j = i + 1; j < ncards && cards[j].rank == cards[i].rank; j++) {
-            num_pairs++;
-        }
+/* Count pairs: n cards of the same rank make C(n, 2) pairs.
+ *
+ *  2♦ 3♥ 3♠ 5♠ -> 1 pair
+ *  2♦ 2♥ 5♣ 5♠ -> 2 pairs
+ *  2♦ 2♥ 2♠ 5♠ -> 3 pairs
+ */
+uint hist_pairs(hand_hist_t *hist) {
+    uint num_pairs = 0;
+    for (int rank = RANK_JOKER; rank <= RANK_KING; rank++) {
+        uint n = hist->ranks[rank];
+        num_pairs += n * (n - 1) / 2;
     }
     return num_pairs;
 }
 
-uint count_runs(hand_t *hand) {
+/* Count run points. Every maximal span of 3 or more consecutive ranks is
+ * worth its length times the product of the number of cards of each rank
+ * in the span:
+ *
+ *  3 4 5     -> run of 3:                  3 points
+ *  3 4 4 5   -> double run of 3:           6 points
+ *  3 3 4 5 5 -> double double run of 3:   12 points
+ *  3 3 3 4 5 -> triple run of 3:           9 points
+ */
+uint hist_runs(hand_hist_t *hist) {
     uint run_points = 0;
-    uint current_run = 1;
+    uint run_len = 0;
     uint repeats = 1;
-    int i;
-    for (i = 1; i < hand->ncards; i++) {
-        rank_t prev_rank = hand->cards[i-1].rank;
-        rank_t cur_rank = hand->cards[i].rank;
-
-        // 3 4: extend current_run to 2
-        // 3 4 5: extend current_run to 3
-        if (prev_rank < RANK_KING && cur_rank == prev_rank + 1) {
-            current_run++;
-        }
-
-        // 3 3: if we see 4 5 next, it's a double run (repeats = 2)
-        // 3 4 4: if we see 5 next, it's a double run (repeats = 2)
-        // 3 4 4 5 5: it's a double double run (repeats = 4)
-        else if (prev_rank == cur_rank) {
-            repeats *= 2;
-        }
-
-        // End of a run (if any).
-        else if (prev_rank < RANK_QUEEN && cur_rank > prev_rank + 1) {
-            if (current_run >= 3) {
-                run_points += current_run * repeats;
-                log_trace("run ended at i=%d: current_run=%d, repeats=%d, run_points=%d",
-                          i,
-                          current_run,
-                          repeats,
-                          run_points);
-            }
-            current_run = 1;
-            repeats = 1;
+    for (int rank = RANK_ACE; rank <= RANK_KING + 1; rank++) {
+        uint n = (rank <= RANK_KING) ? hist->ranks[rank] : 0;
+        if (n > 0) {
+            run_len++;
+            repeats *= n;
+            continue;
+        }
+
+        // End of a span (if any).
+        if (run_len >= 3) {
+            run_points += run_len * repeats;
+            log_trace("run ended at rank %d: run_len=%d, repeats=%d, run_points=%d",
+                      rank,
+                      run_len,
+                      repeats,
+                      run_points);
         }
+        run_len = 0;
+        repeats = 1;
     }
+    return run_points;
+}
 
-    // Fall off the end also counts as the end of a run.
-    if (current_run >= 3) {
-        run_points += current_run * repeats;
-        log_trace("run ended at i=%d: current_run=%d, repeats=%d, run_points=%d",
-                  i,
-                  current_run,
-                  repeats,
-                  run_points);
+/* If every card except the starter is of the same suit, that's a flush.
+ * The starter can extend it by one.
+ */
+uint hist_flush(hand_hist_t *hist) {
+    uint nsuited = hist->nsuited;
+    if (nsuited == 0) {
+        return 0;
+    }
+    for (int suit = SUIT_CLUB; suit <= SUIT_SPADE; suit++) {
+        if (hist->suits[suit] == nsuited) {
+            return nsuited + (hist->starter_suit == suit ? 1 : 0);
+        }
     }
+    return 0;
+}
 
-    return run_points;
+uint count_15s(hand_t *hand) {
+    hand_hist_t hist;
+    hand_hist(&hist, hand);
+    return hist_15s(&hist);
+}
+
+uint count_pairs(hand_t *hand) {
+    hand_hist_t hist;
+    hand_hist(&hist, hand);
+    return hist_pairs(&hist);
+}
+
+uint count_runs(hand_t *hand) {
+    hand_hist_t hist;
+    hand_hist(&hist, hand);
+    return hist_runs(&hist);
 }
 
 uint count_flush(hand_t *hand) {
@@ -171,15 +217,182 @@ uint count_right_jack(hand_t *hand) {
 }
 
 /* Calculate the score of a single hand (which might have any number
- * of cards). hand must already be sorted!
+ * of cards, in any order) by running the histogram kernels on it. This
+ * is the reference implementation that score_hand()'s lookup table is
+ * built from and tested against.
+ */
+score_t score_hand_reference(hand_t *hand) {
+    assert(hand->ncards > 0);
+
+    hand_hist_t hist;
+    hand_hist(&hist, hand);
+
+    score_t score;
+    score.fifteens = 2 * hist_15s(&hist);
+    score.pairs = 2 * hist_pairs(&hist);
+    score.runs = hist_runs(&hist);
+    score.flush = hist_flush(&hist);
+    if (hand->starter >= 0 && hand->cards[hand->starter].rank == RANK_JACK) {
+        // Starter card was a jack: that's handled elsewhere.
+        score.right_jack = 0;
+    }
+    else {
+        score.right_jack = count_right_jack(hand);
+    }
+    score.total = score.fifteens + score.pairs + score.runs + score.flush + score.right_jack;
+
+    return score;
+}
+
+// Fifteens, pairs, and runs depend only on the multiset of ranks in a hand,
+// not on suits or order. There are only 8568 multisets of up to 5 ranks, so
+// we precompute those three components for all of them. Each table entry
+// packs the number of fifteens (bits 0-3), the number of pairs (bits 4-7),
+// and the run points (bits 8-11).
+//
+// A multiset of k ranks r[0] <= r[1] <= ... <= r[k-1] (counting from ace =
+// 0) maps to the k-combination {r[i] + i} of 0 .. 11+k, whose
+// colexicographic rank is sum(C(r[i] + i, i + 1)). Multisets of size k start
+// at rank_offset[k].
+#define RANK_TABLE_CARDS 5
+#define RANK_TABLE_SIZE 8568
+
+static uint16_t rank_table[RANK_TABLE_SIZE];
+static uint16_t rank_offset[RANK_TABLE_CARDS + 1];
+static uint16_t choose[13 + RANK_TABLE_CARDS][RANK_TABLE_CARDS + 1];
+static pthread_once_t rank_table_once = PTHREAD_ONCE_INIT;
+
+static inline uint rank_index(int ncards, uint8_t ranks[]) {
+    uint index = rank_offset[ncards];
+    for (int i = 0; i < ncards; i++) {
+        index += choose[ranks[i] - RANK_ACE + i][i + 1];
+    }
+    return index;
+}
+
+/* Fill in the table for every multiset of ranks that extends ranks[0 ..
+ * ncards-1] with ranks >= min_rank, using hand as scratch space.
+ */
+static void build_rank_table(hand_t *hand, uint8_t ranks[], int ncards, int min_rank) {
+    hand_truncate(hand);
+    for (int i = 0; i < ncards; i++) {
+        hand_append(hand, (card_t) {suit: SUIT_CLUB, rank: ranks[i]});
+    }
+    uint entry = 0;
+    if (ncards > 0) {
+        entry = count_15s(hand) | (count_pairs(hand) << 4) | (count_runs(hand) << 8);
+    }
+    rank_table[rank_index(ncards, ranks)] = entry;
+
+    if (ncards == RANK_TABLE_CARDS) {
+        return;
+    }
+    for (int rank = min_rank; rank <= RANK_KING; rank++) {
+        ranks[ncards] = rank;
+        build_rank_table(hand, ranks, ncards + 1, rank);
+    }
+}
+
+static void init_rank_table(void) {
+    for (int n = 0; n < 13 + RANK_TABLE_CARDS; n++) {
+        choose[n][0] = 1;
+        for (int k = 1; k <= RANK_TABLE_CARDS; k++) {
+            choose[n][k] = (n == 0) ? 0 : choose[n-1][k-1] + choose[n-1][k];
+        }
+    }
+    rank_offset[0] = 0;
+    for (int k = 1; k <= RANK_TABLE_CARDS; k++) {
+        // number of multisets of k-1 ranks: C(12 + (k-1), k-1)
+        rank_offset[k] = rank_offset[k-1] + choose[11 + k][k-1];
+    }
+    assert(rank_offset[RANK_TABLE_CARDS] + choose[12 + RANK_TABLE_CARDS][RANK_TABLE_CARDS]
+           == RANK_TABLE_SIZE);
+
+    hand_t hand;
+    uint8_t ranks[RANK_TABLE_CARDS];
+    hand_init(&hand, RANK_TABLE_CARDS);
+    build_rank_table(&hand, ranks, 0, RANK_ACE);
+}
+
+/* For each possible starter rank, store in points[rank] the points for
+ * fifteens, pairs, and runs in ranks (up to 4 of them, sorted) plus the
+ * starter. This is the inner loop of an expected-value discard, so it
+ * builds the table index incrementally instead of sorting the starter
+ * into ranks 13 times.
+ */
+void score_starter_ranks(int nranks, uint8_t ranks[], uint8_t points[]) {
+    assert(nranks < RANK_TABLE_CARDS);
+    pthread_once(&rank_table_once, init_rank_table);
+
+    // With the starter at position pos, ranks below it keep their index
+    // terms and ranks above it move up one place. below[pos] and
+    // above[pos] sum those two groups of terms.
+    uint below[RANK_TABLE_CARDS];
+    uint above[RANK_TABLE_CARDS];
+    below[0] = 0;
+    for (int i = 0; i < nranks; i++) {
+        below[i + 1] = below[i] + choose[ranks[i] - RANK_ACE + i][i + 1];
+    }
+    above[nranks] = 0;
+    for (int i = nranks - 1; i >= 0; i--) {
+        above[i] = above[i + 1] + choose[ranks[i] - RANK_ACE + i + 1][i + 2];
+    }
+
+    int pos = 0;
+    for (int rank = RANK_ACE; rank <= RANK_KING; rank++) {
+        while (pos < nranks && ranks[pos] <= rank) {
+            pos++;
+        }
+        uint index = rank_offset[nranks + 1]
+            + below[pos]
+            + choose[rank - RANK_ACE + pos][pos + 1]
+            + above[pos];
+        uint entry = rank_table[index];
+        points[rank] = 2 * ((entry & 0xf) + ((entry >> 4) & 0xf)) + (entry >> 8);
+    }
+}
+
+// The score__hand probe (see probes.h).
+#define probe_score_hand(hand, score)           \
+    PROBE8(score__hand,                         \
+           (hand),                              \
+           (hand)->ncards,                      \
+           (score).total,                       \
+           (score).fifteens,                    \
+           (score).pairs,                       \
+           (score).runs,                        \
+           (score).flush,                       \
+           (score).right_jack)
+
+/* Calculate the score of a single hand (which might have any number
+ * of cards, in any order).
  */
 score_t score_hand(hand_t *hand) {
     assert(hand->ncards > 0);
+    if (hand->ncards > RANK_TABLE_CARDS) {
+        score_t score = score_hand_reference(hand);
+        probe_score_hand(hand, score);
+        return score;
+    }
+    pthread_once(&rank_table_once, init_rank_table);
+
+    // Insertion sort of the ranks: hands are usually sorted already.
+    uint8_t ranks[RANK_TABLE_CARDS];
+    for (int i = 0; i < hand->ncards; i++) {
+        uint8_t rank = hand->cards[i].rank;
+        assert(rank >= RANK_ACE);
+        int j = i;
+        for (; j > 0 && ranks[j-1] > rank; j--) {
+            ranks[j] = ranks[j-1];
+        }
+        ranks[j] = rank;
+    }
+    uint entry = rank_table[rank_index(hand->ncards, ranks)];
 
     score_t score;
-    score.fifteens = 2 * count_15s(hand);
-    score.pairs = 2 * count_pairs(hand);
-    score.runs = count_runs(hand);
+    score.fifteens = 2 * (entry & 0xf);
+    score.pairs = 2 * ((entry >> 4) & 0xf);
+    score.runs = entry >> 8;
     score.flush = count_flush(hand);
     if (hand->starter >= 0 && hand->cards[hand->starter].rank == RANK_JACK) {
         // Starter card was a jack: that's handled elsewhere.
@@ -189,11 +402,15 @@ score_t score_hand(hand_t *hand) {
         score.right_jack = count_right_jack(hand);
     }
     score.total = score.fifteens + score.pairs + score.runs + score.flush + score.right_jack;
+    probe_score_hand(hand, score);
 
     return score;
 }
 
 void score_log(char *prefix, score_t score) {
+    if (!log_enabled(LOG_DEBUG)) {
+        return;
+    }
     stringbuilder_t sb;
     sb_init(&sb, 64);
 
@@ -242,6 +459,6 @@ void score_log(char *prefix, score_t score) {
     if (score.total > 0) {
         sb_append_char(&sb, ')');
     }
-    log_debug(sb_as_string(&sb));
+    log_debug("%s", sb_as_string(&sb));
     sb_close(&sb);
 }
@@ -2,6 +2,7 @@
 #define _SCORE_H
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "cards.h"
 
@@ -21,13 +22,30 @@ typedef struct {
     uint total;
 } score_t;
 
+// Histogram of a hand: everything the scoring kernels need to know about
+// it, independent of the order of the cards.
+typedef struct {
+    uint8_t ranks[RANK_KING + 1];   // number of cards of each rank
+    uint8_t suits[SUIT_SPADE + 1];  // number of non-starter cards of each suit
+    uint8_t nsuited;                // number of non-starter cards
+    suit_t starter_suit;            // SUIT_NONE if there is no starter
+} hand_hist_t;
+
+void hand_hist(hand_hist_t *hist, hand_t *hand);
+uint hist_15s(hand_hist_t *hist);
+uint hist_pairs(hand_hist_t *hist);
+uint hist_runs(hand_hist_t *hist);
+uint hist_flush(hand_hist_t *hist);
+
 uint count_15s(hand_t *hand);
 uint count_pairs(hand_t *hand);
 uint count_runs(hand_t *hand);
 uint count_flush(hand_t *hand);
 uint count_right_jack(hand_t *hand);
 
+void score_starter_ranks(int nranks, uint8_t ranks[], uint8_t points[]);
 score_t score_hand(hand_t *hand);
+score_t score_hand_reference(hand_t *hand);
 void score_log(char *prefix, score_t score);
 
 #endif
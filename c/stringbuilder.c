@@ -8,12 +8,13 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "alloc.h"
 #include "stringbuilder.h"
 
 bool sb_init(stringbuilder_t *sb, size_t init_cap) {
     sb->cap = init_cap;
     sb->len = 0;
-    sb->mem = calloc(init_cap, sizeof(char));
+    sb->mem = alloc_calloc(init_cap, sizeof(char));
     if (!sb->mem) {
         sb->cap = 0;
         return false;
@@ -24,7 +25,7 @@ bool sb_init(stringbuilder_t *sb, size_t init_cap) {
 void sb_close(stringbuilder_t *sb)
 {
     if (sb->mem != NULL) {
-        free(sb->mem);
+        alloc_free(sb->mem);
         sb->mem = NULL;
     }
     sb->cap = 0;
@@ -32,13 +33,13 @@ void sb_close(stringbuilder_t *sb)
 }
 
 stringbuilder_t *sb_new(size_t init_cap) {
-    stringbuilder_t *ret = malloc(sizeof(stringbuilder_t));
+    stringbuilder_t *ret = alloc_malloc(sizeof(stringbuilder_t));
     if (!ret) {
         return NULL;
     }
     bool ok = sb_init(ret, init_cap);
     if (!ok) {
-        free(ret);
+        alloc_free(ret);
         return NULL;
     }
     return ret;
@@ -46,7 +47,7 @@ stringbuilder_t *sb_new(size_t init_cap) {
 
 void sb_free(stringbuilder_t *sb) {
     sb_close(sb);
-    free(sb);
+    alloc_free(sb);
 }
 
 #define LOAD_FACTOR 2
@@ -57,7 +58,7 @@ static bool sb_fit_buffer(stringbuilder_t *sb, size_t new_len) {
         sb->cap *= LOAD_FACTOR;
     }
     if (sb->cap != old_cap) {
-        char *new_mem = realloc(sb->mem, sb->cap);
+        char *new_mem = alloc_realloc(sb->mem, sb->cap);
         if (!new_mem) {
             return false;
         }
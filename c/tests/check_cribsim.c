@@ -1,13 +1,31 @@
+#define _POSIX_C_SOURCE 200809L    // for mkstemp()
+
 #include <assert.h>
+#include <pthread.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <check.h>
 
+#include "../alloc.h"
+#include "../canon.h"
 #include "../cards.h"
+#include "../crib.h"
+#include "../discard_cache.h"
+#include "../discard_table.h"
+#include "../handmask.h"
+#include "../logging.h"
+#include "../peg_mc.h"
+#include "../peg_solver.h"
+#include "../phase_timing.h"
 #include "../score.h"
 #include "../stringbuilder.h"
 #include "../play.h"
+#include "../rng.h"
 
 /* Parse a string like "A♥ 3♥ 5♠ 6♦" into cards, and use it to populate hand. */
 static void parse_hand(hand_t *dest, char cards[]) {
@@ -158,6 +176,122 @@ START_TEST(test_stringbuilder_append_int) {
 }
 END_TEST
 
+/* test case: rng */
+
+START_TEST(test_rng_streams) {
+    rng_t rng1, rng2;
+    uint64_t values[10];
+
+    // Same (seed, stream): same values.
+    rng_init(&rng1, 42, 7);
+    rng_init(&rng2, 42, 7);
+    for (int i = 0; i < 10; i++) {
+        values[i] = rng_next(&rng1);
+        ck_assert(values[i] == rng_next(&rng2));
+    }
+
+    // Different stream or different seed: different values.
+    rng_init(&rng2, 42, 8);
+    ck_assert(values[0] != rng_next(&rng2));
+    rng_init(&rng2, 43, 7);
+    ck_assert(values[0] != rng_next(&rng2));
+
+    // We can skip straight to any point in a stream.
+    rng_init(&rng2, 42, 7);
+    rng_seek(&rng2, 6);
+    ck_assert(values[6] == rng_next(&rng2));
+}
+END_TEST
+
+START_TEST(test_rng_below) {
+    rng_t rng;
+    rng_init(&rng, 1, 0);
+
+    int counts[6] = {0, 0, 0, 0, 0, 0};
+    for (int i = 0; i < 6000; i++) {
+        uint32_t value = rng_below(&rng, 6);
+        ck_assert_uint_lt(value, 6);
+        counts[value]++;
+    }
+    // Very loose sanity check: every value turns up a reasonable number of times.
+    for (int i = 0; i < 6; i++) {
+        ck_assert_int_gt(counts[i], 800);
+        ck_assert_int_lt(counts[i], 1200);
+    }
+
+    ck_assert_uint_eq(rng_below(&rng, 1), 0);
+}
+END_TEST
+
+START_TEST(test_shuffle_deck) {
+    deck_t *deck1 = new_deck();
+    deck_t *deck2 = new_deck();
+    rng_t rng;
+
+    rng_init(&rng, 42, 0);
+    shuffle_deck(deck1, &rng);
+    rng_init(&rng, 42, 0);
+    shuffle_deck(deck2, &rng);
+
+    // Same stream, same shuffle: and it is still a permutation of the deck.
+    int seen[14][5];
+    memset(seen, 0, sizeof(seen));
+    for (int i = 0; i < 52; i++) {
+        ck_assert_int_eq(card_cmp(&deck1->cards[i], &deck2->cards[i]), 0);
+        seen[deck1->cards[i].rank][deck1->cards[i].suit]++;
+    }
+    for (int rank = RANK_ACE; rank <= RANK_KING; rank++) {
+        for (int suit = SUIT_CLUB; suit <= SUIT_SPADE; suit++) {
+            ck_assert_int_eq(seen[rank][suit], 1);
+        }
+    }
+
+    // reset_deck() puts it back in order.
+    reset_deck(deck1);
+    ck_assert_int_eq(deck1->cards[0].rank, RANK_ACE);
+    ck_assert_int_eq(deck1->cards[51].rank, RANK_KING);
+    ck_assert_int_eq(deck1->cards[51].suit, SUIT_SPADE);
+
+    alloc_free(deck1);
+    alloc_free(deck2);
+}
+END_TEST
+
+START_TEST(test_deal_batch) {
+    deck_t *deck = new_deck();
+    rng_t rng;
+    deal_t deals[100];
+
+    rng_init(&rng, 42, 0);
+    deal_batch(deck, &rng, 100, deals);
+
+    // The deck is left untouched, and every deal is 13 distinct cards.
+    ck_assert_int_eq(deck->cards[0].rank, RANK_ACE);
+    ck_assert_int_eq(deck->cards[0].suit, SUIT_CLUB);
+    ck_assert_int_eq(deck->cards[51].rank, RANK_KING);
+    ck_assert_int_eq(deck->cards[51].suit, SUIT_SPADE);
+    for (int d = 0; d < 100; d++) {
+        for (int i = 0; i < DEAL_NCARDS; i++) {
+            for (int j = i + 1; j < DEAL_NCARDS; j++) {
+                ck_assert_int_ne(card_cmp(&deals[d].cards[i], &deals[d].cards[j]), 0);
+            }
+        }
+    }
+
+    // A batch is exactly the same as dealing one hand at a time.
+    rng_init(&rng, 42, 0);
+    for (int d = 0; d < 100; d++) {
+        card_t cards[DEAL_NCARDS];
+        deal_cards(deck, &rng, DEAL_NCARDS, cards);
+        for (int i = 0; i < DEAL_NCARDS; i++) {
+            ck_assert_int_eq(card_cmp(&cards[i], &deals[d].cards[i]), 0);
+        }
+    }
+
+    alloc_free(deck);
+}
+END_TEST
+
 /* test case: cards */
 
 START_TEST(test_card_string) {
@@ -202,6 +336,62 @@ START_TEST(test_card_cmp) {
 }
 END_TEST
 
+START_TEST(test_card_encoding) {
+    // Cards are single bytes, so hands and deals are compact.
+    ck_assert_int_eq(sizeof(card_t), 1);
+    ck_assert_int_eq(sizeof(deal_t), 13);
+
+    card_t card = {rank: RANK_QUEEN, suit: SUIT_HEART};
+    ck_assert_int_eq(card_code(card), (RANK_QUEEN << 4) | SUIT_HEART);
+
+    // card_index() is the position of a card in a new (sorted) deck.
+    deck_t *deck = new_deck();
+    for (int i = 0; i < deck->ncards; i++) {
+        ck_assert_int_eq(card_index(deck->cards[i]), i);
+        card = card_from_index(i);
+        ck_assert_int_eq(card_cmp(&card, &deck->cards[i]), 0);
+        if (i > 0) {
+            ck_assert_int_lt(card_cmp(&deck->cards[i-1], &deck->cards[i]), 0);
+        }
+    }
+    alloc_free(deck);
+}
+END_TEST
+
+START_TEST(test_sort_cards) {
+    card_t cards[8];
+    char buf[40];
+
+    // By the 0-1 principle, a sorting network that sorts every sequence of
+    // two distinct values sorts everything.
+    card_t lo = {rank: RANK_ACE, suit: SUIT_CLUB};
+    card_t hi = {rank: RANK_KING, suit: SUIT_SPADE};
+    for (int ncards = 0; ncards <= 8; ncards++) {
+        for (int bits = 0; bits < (1 << ncards); bits++) {
+            for (int i = 0; i < ncards; i++) {
+                cards[i] = (bits & (1 << i)) ? hi : lo;
+            }
+            sort_cards(ncards, cards);
+            for (int i = 1; i < ncards; i++) {
+                ck_assert_int_le(card_cmp(&cards[i-1], &cards[i]), 0);
+            }
+        }
+    }
+
+    hand_t *hand = new_hand(7);
+    parse_hand(hand, "J♥ 5♠ 2♣ Q♥ 5♦ A♠ 5♣");
+    sort_cards(hand->ncards, hand->cards);
+    ck_assert_str_eq(hand_str(buf, sizeof(buf), hand), "A♠ 2♣ 5♣ 5♦ 5♠ J♥ Q♥");
+
+    // Inserting into a sorted hand keeps it sorted.
+    hand->ncards = 5;
+    ck_assert_int_eq(hand_insert_sorted(hand, (card_t) {rank: RANK_5, suit: SUIT_HEART}), 4);
+    ck_assert_int_eq(hand_insert_sorted(hand, (card_t) {rank: RANK_KING, suit: SUIT_CLUB}), 6);
+    ck_assert_str_eq(hand_str(buf, sizeof(buf), hand), "A♠ 2♣ 5♣ 5♦ 5♥ 5♠ K♣");
+    alloc_free(hand);
+}
+END_TEST
+
 START_TEST(test_hand_delete) {
     hand_t *hand = new_hand(4);
 
@@ -256,7 +446,7 @@ START_TEST(test_hand_str) {
     // test truncation when converting into a too-small buffer
     ck_assert_str_eq(hand_str(buf, 17, hand), "5♣ 4♦ 4♦ ");
 
-    free(hand);
+    alloc_free(hand);
 }
 END_TEST
 
@@ -273,8 +463,174 @@ START_TEST(test_new_deck) {
     ck_assert_int_eq(deck->cards[3].suit, SUIT_SPADE);
     ck_assert_int_eq(deck->cards[51].rank, RANK_KING);
     ck_assert_int_eq(deck->cards[51].suit, SUIT_SPADE);
-    free(deck);
+    alloc_free(deck);
+}
+
+START_TEST(test_handmask) {
+    hand_t *hand = new_hand(6);
+    char buf[30];
+
+    // Every card of the deck has its own bit, and the conversion is lossless.
+    deck_t *deck = new_deck();
+    handmask_t deck_mask = 0;
+    for (int i = 0; i < deck->ncards; i++) {
+        card_t card = deck->cards[i];
+        ck_assert(!handmask_has(deck_mask, card));
+        deck_mask = handmask_union(deck_mask, card_mask(card));
+        card_t back = handmask_first(card_mask(card));
+        ck_assert_int_eq(card_cmp(&card, &back), 0);
+    }
+    ck_assert(deck_mask == HANDMASK_DECK);
+    ck_assert_int_eq(handmask_count(deck_mask), 52);
+    alloc_free(deck);
+
+    // Round trip through hand_t sorts the hand.
+    parse_hand(hand, "J♥ 5♠ 2♣ Q♥ 5♦");
+    handmask_t mask = hand_mask(hand);
+    ck_assert_int_eq(handmask_count(mask), 5);
+    handmask_to_hand(hand, mask);
+    ck_assert_str_eq(hand_str(buf, sizeof(buf), hand), "2♣ 5♦ 5♠ J♥ Q♥");
+
+    // Projections.
+    ck_assert_uint_eq(handmask_suit(mask, SUIT_HEART), (1 << 10) | (1 << 11));
+    ck_assert_uint_eq(handmask_suit(mask, SUIT_CLUB), 1 << 1);
+    ck_assert_uint_eq(handmask_ranks(mask), (1 << 1) | (1 << 4) | (1 << 10) | (1 << 11));
+
+    // Removing cards.
+    parse_hand(hand, "5♠ 5♦");
+    mask = handmask_remove(mask, hand_mask(hand));
+    ck_assert_int_eq(handmask_count(mask), 3);
+    ck_assert_uint_eq(handmask_ranks(mask), (1 << 1) | (1 << 10) | (1 << 11));
+
+    // Flush and nobs follow the same rules as count_flush() and count_right_jack().
+    parse_hand(hand, "4♥ 6♥ 7♥ J♥");
+    mask = hand_mask(hand);
+    ck_assert_uint_eq(handmask_flush(mask, (card_t) {suit: SUIT_SPADE, rank: RANK_KING}), 4);
+    ck_assert_uint_eq(handmask_flush(mask, (card_t) {suit: SUIT_HEART, rank: RANK_KING}), 5);
+    ck_assert(handmask_nobs(mask, (card_t) {suit: SUIT_HEART, rank: RANK_KING}));
+    ck_assert(!handmask_nobs(mask, (card_t) {suit: SUIT_SPADE, rank: RANK_KING}));
+    ck_assert(!handmask_nobs(mask, CARD_NONE));
+    ck_assert(!handmask_nobs(HANDMASK_DECK, CARD_NONE));
+    parse_hand(hand, "4♥ 6♦ 7♥ J♥");
+    ck_assert_uint_eq(handmask_flush(hand_mask(hand), (card_t) {suit: SUIT_HEART, rank: RANK_KING}), 0);
+
+    alloc_free(hand);
+}
+END_TEST
+
+START_TEST(test_canon_hand) {
+    hand_t *hand = new_hand(6);
+    canon_t canon1, canon2;
+    char buf[30];
+
+    // The longest suit becomes clubs, and so on.
+    parse_hand(hand, "2♠ 3♠ 4♠ 5♥ 6♥ J♦");
+    canon_hand(&canon1, hand);
+    handmask_to_hand(hand, canon1.hand);
+    ck_assert_str_eq(hand_str(buf, sizeof(buf), hand), "2♣ 3♣ 4♣ 5♦ 6♦ J♥");
+    ck_assert_int_eq(canon1.to_canon[SUIT_SPADE], SUIT_CLUB);
+    ck_assert_int_eq(canon1.from_canon[SUIT_HEART], SUIT_DIAMOND);
+    card_t jack = {suit: SUIT_DIAMOND, rank: RANK_JACK};
+    card_t back = canon_uncard(&canon1, canon_card(&canon1, jack));
+    ck_assert_int_eq(card_cmp(&jack, &back), 0);
+
+    // Permuting suits gives the same class; changing ranks does not.
+    parse_hand(hand, "2♦ 3♦ 4♦ 5♣ 6♣ J♠");
+    canon_hand(&canon2, hand);
+    ck_assert(canon1.hand == canon2.hand);
+    ck_assert_uint_eq(canon1.index, canon2.index);
+    parse_hand(hand, "2♦ 3♦ 4♦ 5♣ 7♣ J♠");
+    canon_hand(&canon2, hand);
+    ck_assert_uint_ne(canon1.index, canon2.index);
+
+    // The starter is not just another card.
+    parse_hand(hand, "5♥ 5♠ J♥ Q♣ K♦");
+    hand->starter = 0;
+    canon_hand(&canon1, hand);
+    hand->starter = 1;
+    canon_hand(&canon2, hand);
+    ck_assert_uint_ne(canon1.index, canon2.index);
+    ck_assert_int_eq(canon1.starter.rank, RANK_5);
+    ck_assert_int_eq(canon1.starter.suit, canon1.to_canon[SUIT_HEART]);
+    ck_assert(!handmask_has(canon1.hand, canon1.starter));
+    ck_assert_int_eq(handmask_count(canon1.hand), 4);
+
+    alloc_free(hand);
+}
+END_TEST
+
+/* Canonicalize every hand of ncards cards (plus every possible starter, if
+ * with_starter), and check that indexes are dense and that each index
+ * belongs to exactly one canonical hand.
+ */
+// What check_canon_all() found at a canonical index.
+typedef struct {
+    bool seen;
+    handmask_t hand;
+    card_t starter;
+} canon_seen_t;
+
+static void check_canon_all(int ncards, bool with_starter) {
+    uint32_t count = canon_count(ncards, with_starter);
+    canon_seen_t *seen = calloc(count, sizeof(canon_seen_t));
+    uint32_t nclasses = 0;
+
+    int index[CANON_MAX_CARDS + 1];
+    int k = 0;
+    index[0] = -1;
+    while (k >= 0) {
+        // Next combination of ncards card indexes, in lexicographic order.
+        if (++index[k] > 52 - ncards + k) {
+            k--;
+            continue;
+        }
+        if (k < ncards - 1) {
+            index[k + 1] = index[k];
+            k++;
+            continue;
+        }
+
+        handmask_t mask = 0;
+        for (int i = 0; i < ncards; i++) {
+            mask |= card_mask(card_from_index(index[i]));
+        }
+        for (int s = with_starter ? 0 : 51; s < 52; s++) {
+            card_t starter = {suit: SUIT_NONE, rank: RANK_JOKER};
+            if (with_starter) {
+                starter = card_from_index(s);
+                if (handmask_has(mask, starter)) {
+                    continue;
+                }
+            }
+            canon_t canon;
+            canon_mask(&canon, mask, starter);
+            // Every index stands for a single canonical hand and starter.
+            ck_assert_uint_lt(canon.index, count);
+            canon_seen_t *at = &seen[canon.index];
+            if (at->seen) {
+                ck_assert(at->hand == canon.hand);
+                ck_assert_int_eq(card_cmp(&at->starter, &canon.starter), 0);
+            }
+            *at = (canon_seen_t) {seen: true, hand: canon.hand, starter: canon.starter};
+            if (canon.hand == mask && (!with_starter || canon.starter.suit == starter.suit)) {
+                nclasses++;
+            }
+        }
+    }
+    ck_assert_uint_eq(nclasses, count);
+    free(seen);
+}
+
+START_TEST(test_canon_index) {
+    ck_assert_uint_eq(canon_count(2, false), 169);
+    ck_assert_uint_eq(canon_count(5, false), 134459);
+    ck_assert_uint_eq(canon_count(1, true), 325);
+    check_canon_all(2, false);
+    check_canon_all(5, false);
+    check_canon_all(2, true);
+    check_canon_all(3, true);
 }
+END_TEST
 
 /* test case: score */
 
@@ -308,7 +664,11 @@ START_TEST(test_count_15s) {
     parse_hand(hand, "2♦ 3♥ 5♠ Q♥");
     ck_assert_int_eq(count_15s(hand), 2);
 
-    free(hand);
+    // Repeated ranks: the best possible hand has eight 15s.
+    parse_hand(hand, "5♦ 5♥ J♠ 5♠ 5♣");
+    ck_assert_int_eq(count_15s(hand), 8);
+
+    alloc_free(hand);
 }
 END_TEST
 
@@ -338,7 +698,11 @@ START_TEST(test_count_pairs) {
     parse_hand(hand, "2♦ 2♥ 2♠ 5♠");
     ck_assert_int_eq(count_pairs(hand), 3);
 
-    free(hand);
+    // Order does not matter.
+    parse_hand(hand, "2♦ 5♣ 2♥ 5♠");
+    ck_assert_int_eq(count_pairs(hand), 2);
+
+    alloc_free(hand);
 }
 END_TEST
 
@@ -363,7 +727,16 @@ START_TEST(test_count_runs) {
     parse_hand(hand, "4♥ 8♦ 8♠ 9♠ 0♥ 0♥");   // double double run of 3: 12 points
     ck_assert_int_eq(count_runs(hand), 12);
 
-    free(hand);
+    parse_hand(hand, "3♥ 3♦ 3♠ 4♠ 5♥");      // triple run of 3: 9 points
+    ck_assert_int_eq(count_runs(hand), 9);
+
+    parse_hand(hand, "0♥ 9♠ 8♦ 4♥ 8♠ 0♥");   // order does not matter
+    ck_assert_int_eq(count_runs(hand), 12);
+
+    parse_hand(hand, "Q♥ K♦ A♠ 2♠ 3♥");      // no wrapping around from K to A
+    ck_assert_int_eq(count_runs(hand), 3);
+
+    alloc_free(hand);
 }
 END_TEST
 
@@ -402,7 +775,7 @@ START_TEST(test_count_flush) {
     parse_hand(hand, "4♦ 6♥ 7♥ Q♥ K♥");
     ck_assert_int_eq(count_flush(hand), 4);
 
-    free(hand);
+    alloc_free(hand);
 }
 
 START_TEST(test_count_right_jack) {
@@ -427,7 +800,7 @@ START_TEST(test_count_right_jack) {
     hand->starter = 3;
     ck_assert_int_eq(count_right_jack(hand), 1);
 
-    free(hand);
+    alloc_free(hand);
 }
 
 START_TEST(test_score_hand) {
@@ -453,12 +826,619 @@ START_TEST(test_score_hand) {
     hand->starter = 4;
     ck_assert_int_eq(score_hand(hand).total, 13);
 
-    free(hand);
+    alloc_free(hand);
+
+    // Larger hands do not have to be sorted either.
+    hand = new_hand(6);
+    parse_hand(hand, "9♥ 3♦ 7♠ 6♦ 8♠ 7♥");  // three 15s, double run of 4, pair
+    ck_assert_int_eq(score_hand(hand).total, 16);
+    alloc_free(hand);
+}
+END_TEST
+
+/* Check score_hand() against score_hand_reference() for every sorted hand
+ * of ncards cards whose ranks are ranks[0 .. depth-1] followed by ranks >=
+ * min_rank. Suits are assigned round-robin, so the hands include flushes.
+ */
+static void check_score_table(hand_t *hand, int ranks[], int depth, int ncards, int min_rank) {
+    if (depth == ncards) {
+        hand_truncate(hand);
+        for (int i = 0; i < ncards; i++) {
+            hand_append(hand, (card_t) {rank: ranks[i], suit: SUIT_CLUB + (i + ranks[0]) % 4});
+        }
+        for (int starter = -1; starter < ncards; starter++) {
+            hand->starter = starter;
+            score_t expect = score_hand_reference(hand);
+            score_t actual = score_hand(hand);
+            ck_assert_int_eq(actual.fifteens, expect.fifteens);
+            ck_assert_int_eq(actual.pairs, expect.pairs);
+            ck_assert_int_eq(actual.runs, expect.runs);
+            ck_assert_int_eq(actual.flush, expect.flush);
+            ck_assert_int_eq(actual.right_jack, expect.right_jack);
+            ck_assert_int_eq(actual.total, expect.total);
+        }
+        hand->starter = -1;
+        return;
+    }
+    for (int rank = min_rank; rank <= RANK_KING; rank++) {
+        ranks[depth] = rank;
+        check_score_table(hand, ranks, depth + 1, ncards, rank);
+    }
+}
+
+START_TEST(test_score_hand_table) {
+    // Fifteens, pairs and runs only depend on ranks, so checking every
+    // multiset of 1 .. 5 ranks checks the lookup table for every hand.
+    hand_t *hand = new_hand(5);
+    int ranks[5];
+    for (int ncards = 1; ncards <= 5; ncards++) {
+        check_score_table(hand, ranks, 0, ncards, RANK_ACE);
+    }
+
+    // Order does not matter for hands of up to 5 cards.
+    parse_hand(hand, "9♥ 6♦ 8♠ 7♥ 7♠");
+    ck_assert_int_eq(score_hand(hand).total, 16);
+
+    alloc_free(hand);
 }
 END_TEST
 
 /* test case: play */
 
+/* Score keep (4 cards) with every starter not in dealt, the hard way. */
+static uint brute_keep_total(hand_t *keep, handmask_t dealt) {
+    hand_t *hand = new_hand(5);
+    uint total = 0;
+    for (int index = 0; index < 52; index++) {
+        card_t starter = card_from_index(index);
+        if (handmask_has(dealt, starter)) {
+            continue;
+        }
+        copy_hand(hand, keep);
+        append_starter(hand, starter);
+        total += score_hand(hand).total;
+    }
+    alloc_free(hand);
+    return total;
+}
+
+START_TEST(test_discard_expected) {
+    deck_t *deck = new_deck();
+    rng_t rng;
+    deal_t deals[200];
+    hand_t *hand = new_hand(6);
+    hand_t *keep = new_hand(4);
+    hand_t *crib = new_hand(4);
+
+    rng_init(&rng, 42, 0);
+    deal_batch(deck, &rng, 200, deals);
+    for (int d = 0; d < 200; d++) {
+        hand_truncate(hand);
+        for (int i = 0; i < 6; i++) {
+            hand_append(hand, deals[d].cards[i]);
+        }
+        sort_cards(hand->ncards, hand->cards);
+        handmask_t dealt = hand_mask(hand);
+
+        uint top_total = 0;
+        for (int drop1 = 0; drop1 < 6; drop1++) {
+            for (int drop2 = drop1 + 1; drop2 < 6; drop2++) {
+                hand_truncate(keep);
+                for (int i = 0; i < 6; i++) {
+                    if (i != drop1 && i != drop2) {
+                        hand_append(keep, hand->cards[i]);
+                    }
+                }
+                uint total = brute_keep_total(keep, dealt);
+                if (total > top_total) {
+                    top_total = total;
+                }
+            }
+        }
+
+        // The cards kept must be one of the best keeps, and the cards
+        // discarded must end up in the crib.
+        hand_truncate(crib);
+        discard_ctx_t ctx = {dealer: d % 2, rng: &rng};
+        discard_expected(hand, crib, &ctx);
+        ck_assert_int_eq(hand->ncards, 4);
+        ck_assert_int_eq(crib->ncards, 2);
+        ck_assert_int_eq(brute_keep_total(hand, dealt), top_total);
+        ck_assert(handmask_union(hand_mask(hand), hand_mask(crib)) == dealt);
+    }
+
+    alloc_free(crib);
+    alloc_free(keep);
+    alloc_free(hand);
+    alloc_free(deck);
+}
+END_TEST
+
+typedef struct {
+    int id;
+    int nworkers;
+    strategy_t *strategy;
+    playername_t *winners;
+} cached_worker_t;
+
+#define CACHED_GAMES 200
+
+/* Play every nworkers-th game, as cribsim's workers do: each game has its
+ * own RNG stream.
+ */
+static void *play_cached_games(void *arg) {
+    cached_worker_t *worker = arg;
+    deck_t *deck = new_deck();
+    rng_t rng;
+    for (int g = worker->id; g < CACHED_GAMES; g += worker->nworkers) {
+        rng_init(&rng, 42, g);
+        worker->winners[g] = play_game(worker->strategy, deck, &rng);
+    }
+    alloc_free(deck);
+    return NULL;
+}
+
+START_TEST(test_discard_cache) {
+    deck_t *deck = new_deck();
+    rng_t rng;
+    deal_t deals[200];
+    hand_t *hand = new_hand(6);
+    hand_t *expect = new_hand(6);
+    hand_t *crib = new_hand(4);
+
+    // A cache big enough for everything, and the smallest possible one.
+    discard_cache_t *caches[2] = {
+        new_discard_cache(discard_expected, NULL, 8 << 20),
+        new_discard_cache(discard_expected, NULL, 0),
+    };
+
+    rng_init(&rng, 42, 0);
+    deal_batch(deck, &rng, 200, deals);
+    for (int pass = 0; pass < 2; pass++) {
+        for (int d = 0; d < 200; d++) {
+            hand_truncate(expect);
+            for (int i = 0; i < 6; i++) {
+                hand_append(expect, deals[d].cards[i]);
+            }
+            sort_cards(expect->ncards, expect->cards);
+            handmask_t dealt = hand_mask(expect);
+            discard_ctx_t ctx = {dealer: d % 2, rng: &rng, data: NULL};
+            hand_truncate(crib);
+            discard_expected(expect, crib, &ctx);
+
+            for (int c = 0; c < 2; c++) {
+                hand_truncate(hand);
+                hand_truncate(crib);
+                for (int i = 0; i < 6; i++) {
+                    hand_append(hand, deals[d].cards[i]);
+                }
+                sort_cards(hand->ncards, hand->cards);
+                ctx.data = caches[c];
+                discard_cached(hand, crib, &ctx);
+
+                // Ties might be broken differently in the canonical hand,
+                // but the decision is just as good.
+                ck_assert_int_eq(hand->ncards, 4);
+                ck_assert_int_eq(crib->ncards, 2);
+                ck_assert(handmask_union(hand_mask(hand), hand_mask(crib)) == dealt);
+                ck_assert_int_eq(brute_keep_total(hand, dealt),
+                                 brute_keep_total(expect, dealt));
+            }
+        }
+    }
+
+    // The second pass hits every time in the big cache.
+    uint64_t hits, misses;
+    discard_cache_stats(caches[0], &hits, &misses);
+    ck_assert_uint_eq(hits + misses, 400);
+    ck_assert_uint_ge(hits, 200);
+    discard_cache_stats(caches[1], &hits, &misses);
+    ck_assert_uint_eq(hits + misses, 400);
+
+    discard_cache_free(caches[1]);
+    discard_cache_free(caches[0]);
+
+    // A random strategy is never cached (it would replay its first choice
+    // for a hand, and use up RNG draws only on misses), so games come out
+    // the same whatever the number of threads sharing the caches.
+    int level = logging_level;
+    logging_set_level(LOG_WARN);
+    playername_t winners[3][CACHED_GAMES];
+    uint64_t lookups[3];
+    int nthreads[3] = {1, 2, 4};
+    for (int t = 0; t < 3; t++) {
+        strategy_t strategy[2] = {
+            (strategy_t) {peg_func: peg_select_low, discard_func: discard_random},
+            (strategy_t) {peg_func: peg_select_low, discard_func: discard_simple},
+        };
+        ck_assert_ptr_eq(discard_cache_wrap(&strategy[0], 1 << 20), NULL);
+        ck_assert(strategy[0].discard_func == discard_random);
+        discard_cache_t *cache = discard_cache_wrap(&strategy[1], 1 << 20);
+        ck_assert_ptr_ne(cache, NULL);
+        ck_assert(strategy[1].discard_func == discard_cached);
+
+        pthread_t threads[4];
+        cached_worker_t workers[4];
+        for (int i = 0; i < nthreads[t]; i++) {
+            workers[i] = (cached_worker_t) {
+                id: i,
+                nworkers: nthreads[t],
+                strategy: strategy,
+                winners: winners[t],
+            };
+            ck_assert_int_eq(pthread_create(&threads[i], NULL, play_cached_games, &workers[i]), 0);
+        }
+        for (int i = 0; i < nthreads[t]; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        // Every thread's lookups are counted.
+        discard_cache_stats(cache, &hits, &misses);
+        lookups[t] = hits + misses;
+        discard_cache_free(cache);
+    }
+    logging_set_level(level);
+    for (int g = 0; g < CACHED_GAMES; g++) {
+        ck_assert_int_eq(winners[1][g], winners[0][g]);
+        ck_assert_int_eq(winners[2][g], winners[0][g]);
+    }
+    ck_assert_uint_gt(lookups[0], 0);
+    ck_assert_uint_eq(lookups[1], lookups[0]);
+    ck_assert_uint_eq(lookups[2], lookups[0]);
+    alloc_free(crib);
+    alloc_free(expect);
+    alloc_free(hand);
+    alloc_free(deck);
+}
+END_TEST
+
+START_TEST(test_discard_table) {
+    deck_t *deck = new_deck();
+    rng_t rng;
+    deal_t deals[100];
+    hand_t *hand = new_hand(6);
+    hand_t *expect = new_hand(6);
+    hand_t *crib = new_hand(4);
+    discard_table_t *table = new_discard_table(false);
+
+    rng_init(&rng, 42, 0);
+    deal_batch(deck, &rng, 100, deals);
+    for (int d = 0; d < 100; d++) {
+        hand_truncate(hand);
+        for (int i = 0; i < 6; i++) {
+            hand_append(hand, deals[d].cards[i]);
+        }
+        canon_t canon;
+        canon_hand(&canon, hand);
+        discard_table_fill(table, canon.hand);
+    }
+
+    // Write the table out and map it back in.
+    char path[] = "/tmp/check_cribsim_XXXXXX";
+    int fd = mkstemp(path);
+    ck_assert_int_ne(fd, -1);
+    close(fd);
+    ck_assert(discard_table_write(path, table));
+    discard_table_t *loaded = discard_table_load(path);
+    ck_assert_ptr_nonnull(loaded);
+    ck_assert_uint_eq(loaded->header->nclasses, canon_count(6, false));
+
+    for (int d = 0; d < 100; d++) {
+        hand_truncate(expect);
+        for (int i = 0; i < 6; i++) {
+            hand_append(expect, deals[d].cards[i]);
+        }
+        sort_cards(expect->ncards, expect->cards);
+        handmask_t dealt = hand_mask(expect);
+        copy_hand(hand, expect);
+
+        // The stored values are the ones discard_values() computes for the
+        // canonical hand.
+        canon_t canon;
+        canon_hand(&canon, hand);
+        hand_t *sorted = new_hand(6);
+        handmask_to_hand(sorted, canon.hand);
+        float value[DISCARD_OPTIONS];
+        discard_values(sorted, d % 2, false, value);
+        for (int option = 0; option < DISCARD_OPTIONS; option++) {
+            int16_t stored = loaded->value[canon.index][d % 2][option];
+            ck_assert(fabsf(stored - value[option] * DISCARD_TABLE_SCALE) <= 0.5f);
+        }
+        alloc_free(sorted);
+
+        // And playing from the table is as good as discard_expected().
+        discard_ctx_t ctx = {dealer: d % 2, rng: &rng, data: NULL};
+        hand_truncate(crib);
+        discard_expected(expect, crib, &ctx);
+        ctx.data = loaded;
+        hand_truncate(crib);
+        discard_table(hand, crib, &ctx);
+        ck_assert_int_eq(hand->ncards, 4);
+        ck_assert(handmask_union(hand_mask(hand), hand_mask(crib)) == dealt);
+        ck_assert_int_eq(brute_keep_total(hand, dealt), brute_keep_total(expect, dealt));
+    }
+
+    discard_table_free(loaded);
+    unlink(path);
+    discard_table_free(table);
+    alloc_free(crib);
+    alloc_free(expect);
+    alloc_free(hand);
+    alloc_free(deck);
+}
+END_TEST
+
+/* Add up the allocation profile of every call site in func. */
+static alloc_site_t alloc_site_totals(const char *func) {
+    alloc_site_t sites[256];
+    int n = alloc_profile_sites(sites, 256);
+    alloc_site_t total = {func: func};
+    for (int i = 0; i < n && i < 256; i++) {
+        if (strcmp(sites[i].func, func) == 0) {
+            total.count += sites[i].count;
+            total.bytes += sites[i].bytes;
+            total.live += sites[i].live;
+            total.peak += sites[i].peak;
+        }
+    }
+    return total;
+}
+
+/* With ALLOC_PROFILE, allocations are counted against the function that
+ * made them, and reallocs move live bytes from one call site to another.
+ * Without it, there are no call sites at all.
+ */
+START_TEST(test_alloc_profile) {
+    alloc_site_t before = alloc_site_totals("new_hand");
+    hand_t *hand1 = new_hand(4);
+    hand_t *hand2 = new_hand(4);
+    alloc_free(hand1);
+    alloc_site_t after = alloc_site_totals("new_hand");
+    alloc_free(hand2);
+    alloc_site_t freed = alloc_site_totals("new_hand");
+
+    alloc_site_t init_before = alloc_site_totals("sb_init");
+    alloc_site_t fit_before = alloc_site_totals("sb_fit_buffer");
+    stringbuilder_t sb;
+    sb_init(&sb, 4);
+    sb_append(&sb, "more than four bytes");
+    alloc_site_t init_after = alloc_site_totals("sb_init");
+    alloc_site_t fit_after = alloc_site_totals("sb_fit_buffer");
+    size_t cap = sb.cap;
+    sb_close(&sb);
+
+#ifdef ALLOC_PROFILE
+    ck_assert_int_eq(after.count - before.count, 2);
+    ck_assert_int_eq(after.bytes - before.bytes, 2 * sizeof(hand_t));
+    ck_assert_int_eq(after.live - before.live, sizeof(hand_t));
+    ck_assert_int_ge(after.peak, after.live + sizeof(hand_t));
+    ck_assert_int_eq(freed.live, before.live);
+
+    ck_assert_int_eq(init_after.count - init_before.count, 1);
+    ck_assert_int_eq(init_after.live, init_before.live);
+    ck_assert_int_ge(fit_after.count - fit_before.count, 1);
+    ck_assert_int_eq(fit_after.live - fit_before.live, cap);
+    ck_assert_int_eq(alloc_site_totals("sb_fit_buffer").live, fit_before.live);
+#else
+    ck_assert_int_eq(alloc_profile_sites(NULL, 0), 0);
+    ck_assert_int_eq(before.count + after.count + freed.count, 0);
+    ck_assert_int_eq(init_before.count + init_after.count, 0);
+    ck_assert_int_eq(fit_before.count + fit_after.count, 0);
+    ck_assert_int_gt(cap, 4);
+#endif
+}
+END_TEST
+
+/* Phase timing counts each phase of a game, and time spent in a phase is
+ * also spent in the phase it is part of. Without PHASE_TIMING, it counts
+ * nothing.
+ */
+START_TEST(test_phase_timing) {
+    strategy_t strategy[2] = {
+        (strategy_t) {peg_func: peg_select_low, discard_func: discard_simple},
+        (strategy_t) {peg_func: peg_select_greedy, discard_func: discard_random},
+    };
+    deck_t *deck = new_deck();
+    rng_t rng;
+    phase_stats_t before, after;
+    double ns_per_tick;
+
+    int level = logging_level;
+    logging_set_level(LOG_WARN);
+    phase_timing_totals(&before, &ns_per_tick);
+    for (int g = 0; g < 10; g++) {
+        rng_init(&rng, 42, g);
+        play_game(strategy, deck, &rng);
+    }
+    phase_timing_totals(&after, &ns_per_tick);
+    logging_set_level(level);
+    alloc_free(deck);
+
+    uint64_t calls[PHASE_COUNT], ticks[PHASE_COUNT];
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        calls[p] = after.calls[p] - before.calls[p];
+        ticks[p] = after.ticks[p] - before.ticks[p];
+    }
+#ifdef PHASE_TIMING
+    ck_assert_int_eq(calls[PHASE_GAME], 10);
+    ck_assert_int_ge(calls[PHASE_DEAL], 10);
+    ck_assert_int_ge(calls[PHASE_HAND], 10 * 8);
+    ck_assert_int_eq(calls[PHASE_DISCARD], calls[PHASE_HAND]);
+    ck_assert_int_eq(calls[PHASE_DISCARD_FUNC], 2 * calls[PHASE_HAND]);
+    ck_assert_int_le(calls[PHASE_PEG], calls[PHASE_HAND]);
+    ck_assert_int_ge(calls[PHASE_PEG_FUNC], 8 * (calls[PHASE_PEG] - 10));
+    ck_assert_int_le(calls[PHASE_SHOW], calls[PHASE_PEG]);
+    ck_assert(ns_per_tick > 0);
+
+    ck_assert(ticks[PHASE_DEAL] + ticks[PHASE_HAND] <= ticks[PHASE_GAME]);
+    ck_assert(ticks[PHASE_DISCARD] + ticks[PHASE_PEG] + ticks[PHASE_SHOW] <=
+              ticks[PHASE_HAND]);
+    ck_assert(ticks[PHASE_DISCARD_FUNC] <= ticks[PHASE_DISCARD]);
+    ck_assert(ticks[PHASE_PEG_FUNC] <= ticks[PHASE_PEG]);
+#else
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        ck_assert_int_eq(calls[p], 0);
+        ck_assert_int_eq(ticks[p], 0);
+    }
+#endif
+}
+END_TEST
+
+#define CRIBSIM_GAMES 300
+
+/* Run build/cribsim (which make check builds first, and runs from the top
+ * directory) with args and nthreads threads, and collect the winner of
+ * every game and the totals it reports.
+ */
+static void run_cribsim(const char *args, int nthreads, char winners[CRIBSIM_GAMES], int wins[2]) {
+    char cmd[256];
+    snprintf(cmd, sizeof(cmd), "build/cribsim -n %d -j %d %s 2>&1", CRIBSIM_GAMES, nthreads, args);
+    FILE *out = popen(cmd, "r");
+    ck_assert_ptr_nonnull(out);
+    memset(winners, 0, CRIBSIM_GAMES);
+    wins[0] = wins[1] = -1;
+
+    char line[512];
+    while (fgets(line, sizeof(line), out) != NULL) {
+        int worker, game;
+        char *tag = strstr(line, "[w");
+        char *winner = strstr(line, "winner=");
+        char *totals = strstr(line, "player a: ");
+        if (tag != NULL && winner != NULL &&
+            sscanf(tag, "[w%d g%d]", &worker, &game) == 2) {
+            ck_assert_int_lt(worker, nthreads);
+            ck_assert(game >= 0 && game < CRIBSIM_GAMES);
+            ck_assert_int_eq(winners[game], 0);
+            winners[game] = winner[strlen("winner=")];
+        }
+        else if (totals != NULL) {
+            ck_assert_int_eq(sscanf(totals, "player a: %d wins, player b: %d wins", &wins[0], &wins[1]), 2);
+        }
+    }
+    ck_assert_msg(pclose(out) == 0, "%s failed", cmd);
+}
+
+/* The same seed gives the same games, and so the same totals, whatever
+ * the number of threads: with a random strategy drawing from each game's
+ * RNG, and with a discard cache shared by the threads.
+ */
+START_TEST(test_cribsim_threads) {
+    // cribsim reports its results at LOG_INFO (an enum, so not #if-able).
+    if (LOG_MIN_LEVEL > LOG_INFO) {
+        return;
+    }
+    const char *args[] = {
+        "-s 42 -a random -b simple",
+        "-s 7 -a expected -B greedy -m 1",
+    };
+    int nthreads[] = {2, 3, 4};
+    for (int a = 0; a < 2; a++) {
+        char expect_winners[CRIBSIM_GAMES];
+        int expect_wins[2];
+        run_cribsim(args[a], 1, expect_winners, expect_wins);
+        ck_assert_int_eq(expect_wins[0] + expect_wins[1], CRIBSIM_GAMES);
+        for (int g = 0; g < CRIBSIM_GAMES; g++) {
+            ck_assert(expect_winners[g] == 'a' || expect_winners[g] == 'b');
+        }
+
+        for (int t = 0; t < 3; t++) {
+            char winners[CRIBSIM_GAMES];
+            int wins[2];
+            run_cribsim(args[a], nthreads[t], winners, wins);
+            ck_assert_int_eq(wins[0], expect_wins[0]);
+            ck_assert_int_eq(wins[1], expect_wins[1]);
+            ck_assert_mem_eq(winners, expect_winners, CRIBSIM_GAMES);
+        }
+    }
+}
+END_TEST
+
+/* A whole game, with any discard strategy, runs without touching the
+ * heap.
+ */
+START_TEST(test_play_game_allocs) {
+    static char *names[] = {"simple", "random", "expected", "crib"};
+    deck_t *deck = new_deck();
+    rng_t rng;
+
+    // The counter does see allocations.
+    uint64_t before = alloc_count();
+    hand_t *hand = new_hand(4);
+    ck_assert_int_eq(alloc_count() - before, 1);
+    alloc_free(hand);
+
+    int level = logging_level;
+    logging_set_level(LOG_WARN);
+    for (int i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        discard_func_t discard = discard_func_by_name(names[i]);
+        strategy_t strategy[2] = {
+            (strategy_t) {peg_func: peg_select_low, discard_func: discard},
+            (strategy_t) {peg_func: peg_select_high, discard_func: discard},
+        };
+
+        // One game first, for one-time initialization (e.g. score tables).
+        rng_init(&rng, 42, 0);
+        play_game(strategy, deck, &rng);
+
+        before = alloc_count();
+        for (int g = 1; g <= 20; g++) {
+            rng_init(&rng, 42, g);
+            play_game(strategy, deck, &rng);
+        }
+        ck_assert_msg(alloc_count() == before,
+                      "discard_%s: %lu allocations in 20 games",
+                      names[i],
+                      (unsigned long) (alloc_count() - before));
+    }
+    logging_set_level(level);
+    alloc_free(deck);
+}
+END_TEST
+
+START_TEST(test_crib_table) {
+    crib_table_t *table = calloc(1, sizeof(crib_table_t));
+    memcpy(table->magic, CRIB_TABLE_MAGIC, sizeof(table->magic));
+    table->version = CRIB_TABLE_VERSION;
+    table->value[1][RANK_5][RANK_5][0] = 8.5;
+    table->value[1][RANK_5][RANK_JACK][0] = 7.0;
+    table->value[1][RANK_JACK][RANK_5][0] = 7.0;
+    table->value[1][RANK_5][RANK_JACK][1] = 7.25;
+    table->value[1][RANK_JACK][RANK_5][1] = 7.25;
+    table->value[0][RANK_5][RANK_JACK][0] = 6.0;
+    table->value[0][RANK_JACK][RANK_5][0] = 6.0;
+
+    char path[] = "/tmp/check_cribsim_XXXXXX";
+    int fd = mkstemp(path);
+    ck_assert_int_ne(fd, -1);
+    close(fd);
+    ck_assert(crib_table_write(path, table));
+    const crib_table_t *loaded = crib_table_load(path);
+    ck_assert_ptr_nonnull(loaded);
+    crib_table_use(loaded);
+
+    card_t five_h = {rank: RANK_5, suit: SUIT_HEART};
+    card_t five_s = {rank: RANK_5, suit: SUIT_SPADE};
+    card_t jack_h = {rank: RANK_JACK, suit: SUIT_HEART};
+    card_t jack_c = {rank: RANK_JACK, suit: SUIT_CLUB};
+    ck_assert(crib_value(five_h, five_s, true) == 8.5f);
+    ck_assert(crib_value(five_h, jack_c, true) == 7.0f);
+    ck_assert(crib_value(jack_c, five_h, true) == 7.0f);
+    ck_assert(crib_value(jack_h, five_h, true) == 7.25f);
+    ck_assert(crib_value(five_h, jack_c, false) == 6.0f);
+
+    // Without a table, every discard is worth nothing.
+    crib_table_use(NULL);
+    ck_assert(crib_value(five_h, five_s, true) == 0.0f);
+
+    // Anything that is not a crib table is rejected.
+    table->version++;
+    ck_assert(crib_table_write(path, table));
+    ck_assert_ptr_null(crib_table_load(path));
+
+    unlink(path);
+    free(table);
+}
+END_TEST
+
 typedef struct {
     char *hand_0;
     char *hand_1;
@@ -579,7 +1559,19 @@ static peg_test_t peg_tests[] = {
         expect_plays: {"6♦ 2♣ 7♠ 6♠ 8♥", "7♥ 9♥ K♣", NULL},
         expect_counts: {29, 26, -1},
         expect_points: {6, 1},
-    }
+    },
+
+    // Four of a kind is worth 12.
+    // Play A, A, A, A: 2 points to player 1, 6 to player 0, 12 to player 1.
+    // Play 6, 7, 9: count is 26, player 1 blocked, 1 point to player 0.
+    // Play 8: count is 8, 1 point to player 1 for last card.
+    {
+        hand_0: "A♣ A♦ 6♠ 9♠",
+        hand_1: "A♥ A♠ 7♦ 8♦",
+        expect_plays: {"A♣ A♥ A♦ A♠ 6♠ 7♦ 9♠", "8♦", NULL},
+        expect_counts: {26, 8, -1},
+        expect_points: {7, 15},
+    },
 };
 
 bool count_pegging(void *data, int player, uint points) {
@@ -614,7 +1606,7 @@ START_TEST(test_peg_hands) {
     game_state.player_name[1] = PLAYER_A;
     parse_hand(hands[0], tc.hand_0);
     parse_hand(hands[1], tc.hand_1);
-    peg_hands(2, peg, hands, select_func, count_pegging, &game_state);
+    peg_hands(2, peg, hands, NULL, CARD_NONE, select_func, count_pegging, &game_state);
 
     printf("peg_tests[%d]: actual_counts={%d, %d, %d}, actual_points={%d, %d}\n",
            i,
@@ -636,12 +1628,12 @@ START_TEST(test_peg_hands) {
     char buf[buf_size];
 
     for (i = 0; i < MAX_ROUNDS; i++) {
-        hand_t *played = peg->cards_played[i];
+        hand_t *played = &peg->cards_played[i];
         if (tc.expect_plays[i] == NULL) {
-            ck_assert_ptr_null(played);
+            ck_assert_int_eq(played->ncards, 0);
         }
         else {
-            ck_assert_ptr_nonnull(played);
+            ck_assert_int_gt(played->ncards, 0);
             ck_assert_str_eq(tc.expect_plays[i], hand_str(buf, buf_size, played));
         }
     }
@@ -649,6 +1641,406 @@ START_TEST(test_peg_hands) {
 }
 END_TEST
 
+// Every decision of the real pegging (in test_peg_state_clone) copies the
+// state and plays the copy out to the end.
+#define MAX_CLONES 16
+static peg_state_t clones[MAX_CLONES];
+static int nclones;
+
+static bool ignore_points(void *data, int player, uint points) {
+    return false;
+}
+
+static int select_low_and_clone(peg_state_t *peg, int player, int other) {
+    int selected = peg_select_low(peg, player, other);
+    if (nclones < MAX_CLONES) {
+        peg_state_t *clone = &clones[nclones++];
+        peg_func_t select_low[2] = {peg_select_low, peg_select_low};
+        *clone = *peg;
+        peg_play_card(clone, selected, ignore_points, NULL);
+        peg_play_out(clone, select_low, ignore_points, NULL);
+    }
+    return selected;
+}
+
+START_TEST(test_peg_state_clone) {
+    peg_test_t tc = peg_tests[_i];
+    hand_t hand_0, hand_1;
+    hand_t *hands[2] = {&hand_0, &hand_1};
+    hand_init(&hand_0, 4);
+    hand_init(&hand_1, 4);
+    parse_hand(hands[0], tc.hand_0);
+    parse_hand(hands[1], tc.hand_1);
+
+    // Reuse one state, dirty from a previous hand, like evaluate_hands().
+    peg_state_t peg;
+    peg_func_t select_func[2] = {select_low_and_clone, select_low_and_clone};
+    peg_state_reset(&peg, 4);
+    peg_hands(2, &peg, hands, NULL, CARD_NONE, select_func, ignore_points, NULL);
+    peg_state_reset(&peg, 4);
+    nclones = 0;
+    peg_hands(2, &peg, hands, NULL, CARD_NONE, select_func, ignore_points, NULL);
+
+    ck_assert_int_eq(peg.points[0], tc.expect_points[0]);
+    ck_assert_int_eq(peg.points[1], tc.expect_points[1]);
+    ck_assert_int_gt(nclones, 0);
+    for (int c = 0; c < nclones; c++) {
+        ck_assert(clones[c].done);
+        ck_assert_int_eq(clones[c].points[0], peg.points[0]);
+        ck_assert_int_eq(clones[c].points[1], peg.points[1]);
+        ck_assert_int_eq(clones[c].num_rounds, peg.num_rounds);
+        for (int r = 0; r < MAX_ROUNDS; r++) {
+            ck_assert_int_eq(clones[c].counts[r], peg.counts[r]);
+            ck_assert_int_eq(clones[c].cards_played[r].ncards, peg.cards_played[r].ncards);
+            ck_assert(memcmp(clones[c].cards_played[r].cards,
+                             peg.cards_played[r].cards,
+                             peg.cards_played[r].ncards) == 0);
+        }
+    }
+}
+END_TEST
+
+/* Reference pegging scores for the last card of cards[], by brute force:
+ * the longest tail that sorts into a run, and the number of trailing
+ * cards of the same rank.
+ */
+static uint reference_run_points(int ncards, card_t cards[]) {
+    for (int len = ncards; len >= 3; len--) {
+        card_t tail[len];
+        memcpy(tail, cards + ncards - len, len * sizeof(card_t));
+        sort_cards(len, tail);
+        bool run = true;
+        for (int i = 1; i < len; i++) {
+            run = run && tail[i].rank == tail[i-1].rank + 1;
+        }
+        if (run) {
+            return len;
+        }
+    }
+    return 0;
+}
+
+static uint reference_pair_points(int ncards, card_t cards[]) {
+    int same = 1;
+    while (same < ncards && cards[ncards - 1 - same].rank == cards[ncards - 1].rank) {
+        same++;
+    }
+    return same * (same - 1);
+}
+
+static rng_t check_rng;
+static int ncard_checks;
+
+/* Pegging strategy that checks the scorer on every playable card before
+ * picking one at random: peg_card_points() must predict what playing the
+ * card actually scores, and the pair and run points must match the brute
+ * force ones.
+ */
+static int select_random_and_check(peg_state_t *peg, int player, int other) {
+    hand_t *avail = &peg->avail[player];
+    int playable[HAND_MAX_CARDS];
+    int nplayable = 0;
+    for (int i = 0; i < avail->ncards; i++) {
+        card_t card = avail->cards[i];
+        if (peg->cur_count + rank_value[card.rank] > 31) {
+            continue;
+        }
+        playable[nplayable++] = i;
+
+        card_t played[HAND_MAX_CARDS + 1];
+        int nplayed = peg->cur_played.ncards;
+        memcpy(played, peg->cur_played.cards, nplayed * sizeof(card_t));
+        played[nplayed++] = card;
+        ck_assert_int_eq(peg_pair_points(peg, card), reference_pair_points(nplayed, played));
+        ck_assert_int_eq(peg_run_points(peg, card), reference_run_points(nplayed, played));
+
+        peg_state_t clone = *peg;
+        peg_play_card(&clone, i, ignore_points, NULL);
+        ck_assert_int_eq(peg_card_points(peg, card), clone.points[player] - peg->points[player]);
+        ncard_checks++;
+    }
+    if (nplayable == 0) {
+        return -1;
+    }
+    return playable[rng_below(&check_rng, nplayable)];
+}
+
+START_TEST(test_peg_card_points) {
+    deck_t *deck = new_deck();
+    peg_func_t select_func[2] = {select_random_and_check, select_random_and_check};
+    rng_init(&check_rng, 42, 0);
+    ncard_checks = 0;
+
+    for (int n = 0; n < 2000; n++) {
+        card_t cards[8];
+        hand_t hand_0, hand_1;
+        hand_t *hands[2] = {&hand_0, &hand_1};
+        hand_init(&hand_0, 4);
+        hand_init(&hand_1, 4);
+        reset_deck(deck);
+        deal_cards(deck, &check_rng, 8, cards);
+        for (int i = 0; i < 4; i++) {
+            hand_append(&hand_0, cards[i]);
+            hand_append(&hand_1, cards[4 + i]);
+        }
+
+        peg_state_t peg;
+        peg_state_reset(&peg, 4);
+        peg_hands(2, &peg, hands, NULL, CARD_NONE, select_func, ignore_points, NULL);
+    }
+    ck_assert_int_gt(ncard_checks, 2000 * 8);
+    alloc_free(deck);
+}
+END_TEST
+
+/* Value of peg for the player to move, by searching the whole tree. */
+static int reference_peg_value(peg_state_t *peg) {
+    int player = peg->player;
+    int other = peg->other;
+    hand_t *avail = &peg->avail[player];
+    int best = INT_MIN;
+    for (int i = 0; i < avail->ncards; i++) {
+        if (peg->cur_count + rank_value[avail->cards[i].rank] > 31) {
+            continue;
+        }
+        peg_state_t child = *peg;
+        peg_play_card(&child, i, ignore_points, NULL);
+        int value = ((int) (child.points[player] - peg->points[player]) -
+                     (int) (child.points[other] - peg->points[other]));
+        if (!child.done) {
+            peg_next_turn(&child);
+            int child_value = reference_peg_value(&child);
+            value += (child.player == player) ? child_value : -child_value;
+        }
+        if (value > best) {
+            best = value;
+        }
+    }
+    if (best == INT_MIN) {
+        // Nothing fits: say go.
+        peg_state_t child = *peg;
+        peg_play_card(&child, -1, ignore_points, NULL);
+        peg_next_turn(&child);
+        int child_value = reference_peg_value(&child);
+        best = -(int) (child.points[other] - peg->points[other]) +
+            ((child.player == player) ? child_value : -child_value);
+    }
+    return best;
+}
+
+START_TEST(test_peg_solver) {
+    deck_t *deck = new_deck();
+    rng_t rng;
+    rng_init(&rng, 42, 0);
+    peg_solver_t *solver = new_peg_solver(12);
+    peg_func_t select_func[2] = {peg_select_solver, peg_select_solver};
+    int level = logging_level;
+    logging_set_level(LOG_WARN);
+
+    for (int n = 0; n < 300; n++) {
+        card_t cards[8];
+        hand_t hand_0, hand_1;
+        hand_t *hands[2] = {&hand_0, &hand_1};
+        hand_init(&hand_0, 4);
+        hand_init(&hand_1, 4);
+        reset_deck(deck);
+        deal_cards(deck, &rng, 8, cards);
+        for (int i = 0; i < 4; i++) {
+            hand_append(&hand_0, cards[i]);
+            hand_append(&hand_1, cards[4 + i]);
+        }
+
+        peg_solution_t solution;
+        int value = peg_solve_hands(solver, hands, &solution);
+        ck_assert_int_eq(solution.value, value);
+
+        peg_state_t peg;
+        peg_state_reset(&peg, 4);
+        peg_start(&peg, hands, NULL, CARD_NONE);
+        peg_next_turn(&peg);
+        ck_assert_int_eq(value, reference_peg_value(&peg));
+
+        // Playing out the principal variation scores exactly the value.
+        for (int m = 0; m < solution.nmoves; m++) {
+            peg_move_t *move = &solution.moves[m];
+            ck_assert_int_eq(move->player, peg.player);
+            int selected = -1;
+            for (int i = 0; i < peg.avail[peg.player].ncards; i++) {
+                if (card_code(peg.avail[peg.player].cards[i]) == card_code(move->card)) {
+                    selected = i;
+                }
+            }
+            ck_assert(selected >= 0 || move->card.rank == RANK_JOKER);
+            peg_play_card(&peg, selected, ignore_points, NULL);
+            if (m < solution.nmoves - 1) {
+                ck_assert(!peg.done);
+                peg_next_turn(&peg);
+            }
+        }
+        ck_assert(peg.done);
+        ck_assert_int_eq((int) peg.points[0] - (int) peg.points[1], value);
+
+        // ... and so does the solver strategy against itself.
+        peg_state_reset(&peg, 4);
+        peg_hands(2, &peg, hands, NULL, CARD_NONE, select_func, ignore_points, NULL);
+        ck_assert_int_eq((int) peg.points[0] - (int) peg.points[1], value);
+    }
+    ck_assert_int_gt(solver->nodes, 0);
+    logging_set_level(level);
+    peg_solver_free(solver);
+    alloc_free(deck);
+}
+END_TEST
+
+/* Peg ndeals random 4-card deals with the given strategies, and return
+ * player 0's points minus player 1's over all of them.
+ */
+static int peg_random_deals(int ndeals, peg_func_t select_func[2]) {
+    deck_t *deck = new_deck();
+    rng_t rng;
+    rng_init(&rng, 42, 1);
+    int diff = 0;
+    for (int n = 0; n < ndeals; n++) {
+        card_t cards[8];
+        hand_t hand_0, hand_1;
+        hand_t *hands[2] = {&hand_0, &hand_1};
+        hand_init(&hand_0, 4);
+        hand_init(&hand_1, 4);
+        reset_deck(deck);
+        deal_cards(deck, &rng, 8, cards);
+        for (int i = 0; i < 4; i++) {
+            hand_append(&hand_0, cards[i]);
+            hand_append(&hand_1, cards[4 + i]);
+        }
+        sort_cards(4, hand_0.cards);
+        sort_cards(4, hand_1.cards);
+
+        peg_state_t peg;
+        peg_state_reset(&peg, 4);
+        peg_hands(2, &peg, hands, NULL, CARD_NONE, select_func, ignore_points, NULL);
+        diff += (int) peg.points[0] - (int) peg.points[1];
+    }
+    alloc_free(deck);
+    return diff;
+}
+
+START_TEST(test_peg_select_mc) {
+    peg_func_t greedy_greedy[2] = {peg_select_greedy, peg_select_greedy};
+    peg_func_t mc_greedy[2] = {peg_select_mc, peg_select_greedy};
+    peg_func_t greedy_mc[2] = {peg_select_greedy, peg_select_mc};
+    int level = logging_level;
+    logging_set_level(LOG_WARN);
+
+    // Seeing what has been played beats just grabbing points, on both
+    // sides.
+    int baseline = peg_random_deals(300, greedy_greedy);
+    uint64_t before = alloc_count();
+    ck_assert_int_gt(peg_random_deals(300, mc_greedy), baseline);
+    ck_assert_int_lt(peg_random_deals(300, greedy_mc), baseline);
+
+    // Without a time limit, it is deterministic.
+    ck_assert_int_eq(peg_random_deals(50, mc_greedy), peg_random_deals(50, mc_greedy));
+
+    // Nothing allocated but the decks.
+    ck_assert_int_eq(alloc_count() - before, 4);
+
+    // The time limit cuts sampling short.
+    peg_mc_config_t config = peg_mc_config;
+    peg_mc_config.nsamples = 1 << 30;
+    peg_mc_config.max_ns = 100000;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    peg_random_deals(10, mc_greedy);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ck_assert_int_lt(end.tv_sec - start.tv_sec, 5);
+    peg_mc_config = config;
+    logging_set_level(level);
+}
+END_TEST
+
+/* Play card (e.g. "K♥"), or say go if card is "", for the next player. */
+static void peg_play_named(peg_state_t *peg, char *card) {
+    hand_t named;
+    hand_init(&named, 1);
+    parse_hand(&named, card);
+    peg_next_turn(peg);
+    int selected = -1;
+    hand_t *avail = &peg->avail[peg->player];
+    for (int i = 0; i < avail->ncards && named.ncards > 0; i++) {
+        if (card_cmp(&avail->cards[i], &named.cards[0]) == 0) {
+            selected = i;
+        }
+    }
+    ck_assert(named.ncards == 0 || selected != -1);
+    peg_play_card(peg, selected, ignore_points, NULL);
+}
+
+/* The Monte Carlo strategy never deals the other player a card that the
+ * player to move knows they cannot have: the starter, the player's own
+ * discards, or a card that would have fitted when they said go.
+ */
+START_TEST(test_peg_mc_sampler) {
+    hand_t hand_0, hand_1, crib, starter;
+    hand_t *hands[2] = {&hand_0, &hand_1};
+    hand_init(&hand_0, 4);
+    hand_init(&hand_1, 4);
+    hand_init(&crib, 5);
+    hand_init(&starter, 1);
+    parse_hand(&hand_0, "K♥ 9♣ Q♥ 2♦");
+    parse_hand(&hand_1, "J♠ 0♠ 8♦ 7♣");
+    parse_hand(&crib, "5♥ 5♣ 4♠ 3♦");
+    parse_hand(&starter, "5♦");
+
+    peg_state_t peg;
+    peg_state_reset(&peg, 4);
+    peg_start(&peg, hands, &crib, starter.cards[0]);
+    peg_play_named(&peg, "K♥");
+    peg_play_named(&peg, "J♠");
+    peg_play_named(&peg, "9♣");
+    peg_play_named(&peg, "");           // 29: nothing fits
+    peg_next_turn(&peg);
+    ck_assert_int_eq(peg.player, 0);
+    ck_assert(peg.blocked[1]);
+    ck_assert_int_eq(peg.min_value[1], 3);
+
+    // Player 0 has seen 8 cards (their own 4, J♠, the starter and 2
+    // discards); of the other 44, 7 aces and twos would have fitted.
+    handmask_t seen = 0;
+    char *seen_cards[] = {"K♥", "9♣", "Q♥", "2♦", "J♠", "5♦", "5♥", "5♣"};
+    for (int i = 0; i < 8; i++) {
+        hand_t one;
+        hand_init(&one, 1);
+        parse_hand(&one, seen_cards[i]);
+        seen |= card_mask(one.cards[0]);
+    }
+    peg_mc_sampler_t sampler;
+    peg_mc_sampler_init(&sampler, &peg, 0, 1);
+    ck_assert_int_eq(sampler.nhidden, 3);
+    ck_assert_int_eq(sampler.npool, 52 - 8 - 7);
+
+    rng_t rng;
+    rng_init(&rng, 42, 0);
+    handmask_t dealt = 0;
+    for (int n = 0; n < 1000; n++) {
+        hand_t hidden;
+        hand_init(&hidden, 4);
+        peg_mc_sample(&sampler, &rng, &hidden);
+        ck_assert_int_eq(hidden.ncards, 3);
+        for (int i = 0; i < hidden.ncards; i++) {
+            ck_assert(!(card_mask(hidden.cards[i]) & seen));
+            ck_assert_int_ge(rank_value[hidden.cards[i].rank], 3);
+            dealt |= card_mask(hidden.cards[i]);
+        }
+    }
+    // The other player's discards are fair game: player 0 never saw them.
+    ck_assert(dealt & card_mask(crib.cards[2]));
+    ck_assert(dealt & card_mask(crib.cards[3]));
+
+    // The strategy itself plays the only card that fits.
+    ck_assert_int_eq(peg_select_mc(&peg, 0, 1), 1);
+}
+END_TEST
+
 START_TEST(test_add_starter) {
     hand_t *hand = new_hand(5);
     parse_hand(hand, "4♠ 7♠ 9♠ 0♠");
@@ -743,18 +2135,119 @@ START_TEST(test_evaluate_hands) {
     ck_assert_int_eq(game_state.winner, tc.expect_winner);
     ck_assert(done == tc.expect_done);
 
-    free(hands[0]);
-    free(hands[1]);
-    free(crib);
+    alloc_free(hands[0]);
+    alloc_free(hands[1]);
+    alloc_free(crib);
+}
+END_TEST
+
+static void *log_from_worker(void *arg) {
+    async_log_thread(3);
+    async_log_game(17);
+    async_log(LOG_INFO, __FILE__, __LINE__, "worker says %s", (char *) arg);
+    return NULL;
+}
+
+START_TEST(test_async_log) {
+    FILE *fp = tmpfile();
+    ck_assert_ptr_nonnull(fp);
+    ck_assert(async_log_start(fp, 4096));
+
+    // Plenty of records to wrap around a small ring; the buffer is gone
+    // before the writer formats its record. These call async_log() directly,
+    // since log_info() is compiled out under make LOG_MIN_LEVEL=LOG_WARN.
+    int record_line = 0;
+    for (int i = 0; i < 500; i++) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "string %d", i);
+        record_line = __LINE__ + 1;
+        async_log(LOG_INFO, __FILE__, __LINE__, "record %d: %s, %5.2f, %lu, %c, 100%%",
+                  i, buf, i / 4.0, 1UL << 40, 'x');
+    }
+    pthread_t thread;
+    ck_assert_int_eq(pthread_create(&thread, NULL, log_from_worker, "hello"), 0);
+    pthread_join(thread, NULL);
+    async_log_stop();
+    ck_assert(!logging_async);
+
+    rewind(fp);
+    char line[256];
+    int nrecords = 0;
+    bool worker_seen = false;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (strstr(line, "[w3 g17] ") != NULL) {
+            ck_assert_ptr_nonnull(strstr(line, ": worker says hello\n"));
+            worker_seen = true;
+            continue;
+        }
+        char expect[128];
+        snprintf(expect,
+                 sizeof(expect),
+                 "INFO  [main] c/tests/check_cribsim.c:%d: record %d: string %d, %5.2f, %lu, x, 100%%\n",
+                 record_line,
+                 nrecords,
+                 nrecords,
+                 nrecords / 4.0,
+                 1UL << 40);
+        ck_assert_str_eq(line + 9, expect);
+        nrecords++;
+    }
+    ck_assert_int_eq(nrecords, 500);
+    ck_assert(worker_seen);
+    fclose(fp);
+}
+END_TEST
+
+// A worker that logs once in each of two async logging runs, with the
+// main thread stopping and restarting async logging in between.
+static void *log_across_restart(void *arg) {
+    pthread_barrier_t *barrier = arg;
+    async_log_thread(5);
+    async_log(LOG_INFO, __FILE__, __LINE__, "before restart");
+    pthread_barrier_wait(barrier);      // main: stop, start
+    pthread_barrier_wait(barrier);
+    async_log(LOG_INFO, __FILE__, __LINE__, "after restart");
+    return NULL;
+}
+
+START_TEST(test_async_log_restart) {
+    FILE *fp = tmpfile();
+    ck_assert_ptr_nonnull(fp);
+    pthread_barrier_t barrier;
+    pthread_barrier_init(&barrier, NULL, 2);
+    ck_assert(async_log_start(fp, 4096));
+    pthread_t thread;
+    ck_assert_int_eq(pthread_create(&thread, NULL, log_across_restart, &barrier), 0);
+    pthread_barrier_wait(&barrier);
+    async_log_stop();
+    // The worker's old ring is gone: it must not log to it.
+    ck_assert(async_log_start(fp, 4096));
+    pthread_barrier_wait(&barrier);
+    pthread_join(thread, NULL);
+    async_log_stop();
+    pthread_barrier_destroy(&barrier);
+
+    rewind(fp);
+    char line[256];
+    int nlines = 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        ck_assert_ptr_nonnull(strstr(line, "[w5] "));
+        ck_assert_ptr_nonnull(strstr(line, nlines == 0 ? ": before restart\n" : ": after restart\n"));
+        nlines++;
+    }
+    ck_assert_int_eq(nlines, 2);
+    fclose(fp);
 }
 END_TEST
 
 Suite *cribsum_suite(void) {
     Suite *suite = suite_create("cribsim");
     TCase *tc_stringbuilder = tcase_create("stringbuilder");
+    TCase *tc_rng = tcase_create("rng");
     TCase *tc_cards = tcase_create("cards");
     TCase *tc_score = tcase_create("score");
     TCase *tc_play = tcase_create("play");
+    TCase *tc_log = tcase_create("log");
     int ntests;
 
     tcase_add_test(tc_stringbuilder, test_stringbuilder_basics);
@@ -762,11 +2255,22 @@ Suite *cribsum_suite(void) {
     tcase_add_test(tc_stringbuilder, test_stringbuilder_append_int);
     suite_add_tcase(suite, tc_stringbuilder);
 
+    tcase_add_test(tc_rng, test_rng_streams);
+    tcase_add_test(tc_rng, test_rng_below);
+    tcase_add_test(tc_rng, test_shuffle_deck);
+    tcase_add_test(tc_rng, test_deal_batch);
+    suite_add_tcase(suite, tc_rng);
+
     tcase_add_test(tc_cards, test_card_string);
     tcase_add_test(tc_cards, test_card_cmp);
+    tcase_add_test(tc_cards, test_card_encoding);
+    tcase_add_test(tc_cards, test_sort_cards);
     tcase_add_test(tc_cards, test_hand_delete);
     tcase_add_test(tc_cards, test_hand_str);
     tcase_add_test(tc_cards, test_new_deck);
+    tcase_add_test(tc_cards, test_handmask);
+    tcase_add_test(tc_cards, test_canon_hand);
+    tcase_add_test(tc_cards, test_canon_index);
     suite_add_tcase(suite, tc_cards);
 
     tcase_add_test(tc_score, test_count_15s);
@@ -775,16 +2279,34 @@ Suite *cribsum_suite(void) {
     tcase_add_test(tc_score, test_count_flush);
     tcase_add_test(tc_score, test_count_right_jack);
     tcase_add_test(tc_score, test_score_hand);
+    tcase_add_test(tc_score, test_score_hand_table);
     suite_add_tcase(suite, tc_score);
 
     ntests = sizeof(peg_tests) / sizeof(peg_test_t);
     tcase_add_loop_test(tc_play, test_peg_hands, 0, ntests);
+    tcase_add_loop_test(tc_play, test_peg_state_clone, 0, ntests);
+    tcase_add_test(tc_play, test_peg_card_points);
+    tcase_add_test(tc_play, test_peg_solver);
+    tcase_add_test(tc_play, test_peg_select_mc);
+    tcase_add_test(tc_play, test_peg_mc_sampler);
 
     tcase_add_test(tc_play, test_add_starter);
+    tcase_add_test(tc_play, test_discard_expected);
+    tcase_add_test(tc_play, test_discard_cache);
+    tcase_add_test(tc_play, test_discard_table);
+    tcase_add_test(tc_play, test_cribsim_threads);
+    tcase_add_test(tc_play, test_play_game_allocs);
+    tcase_add_test(tc_play, test_phase_timing);
+    tcase_add_test(tc_play, test_alloc_profile);
+    tcase_add_test(tc_play, test_crib_table);
     ntests = sizeof(evaluate_hands_tests) / sizeof(evaluate_hands_test_t);
     tcase_add_loop_test(tc_play, test_evaluate_hands, 0, ntests);
     suite_add_tcase(suite, tc_play);
 
+    tcase_add_test(tc_log, test_async_log);
+    tcase_add_test(tc_log, test_async_log_restart);
+    suite_add_tcase(suite, tc_log);
+
     return suite;
 }
 
@@ -0,0 +1,249 @@
+#define _POSIX_C_SOURCE 200809L    // for getopt(), pthreads
+
+/* Generate a crib table (see crib.h) by simulation.
+ *
+ * For every simulated deal, the opponent discards from their 6 cards,
+ * and each of the 15 pairs we could discard from our 6 cards is scored
+ * in a crib with the opponent's discards and the starter. Scores are
+ * summed by the rank pair (and suitedness) of our discards, once with us
+ * as the dealer and once as the pone.
+ *
+ * The opponent discards with discard_crib(), using the table from the
+ * previous pass; the first pass has no table, so the opponent only cares
+ * about their hand. A couple of passes are enough for the table to
+ * settle.
+ */
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../alloc.h"
+#include "../cards.h"
+#include "../crib.h"
+#include "../logging.h"
+#include "../play.h"
+#include "../rng.h"
+#include "../score.h"
+
+// Deals per RNG stream: streams are the unit of work for the workers.
+#define BATCH 64
+
+typedef struct {
+    pthread_t thread;
+    int id;
+    int nworkers;
+    uint64_t seed;
+    uint64_t first_stream;
+    uint64_t nbatches;
+    bool dealer;
+
+    // Points and number of cribs by [rank 1][rank 2][suited], with
+    // rank 1 <= rank 2. Integers, so the totals do not depend on how the
+    // work was split between threads.
+    uint64_t points[RANK_KING + 1][RANK_KING + 1][2];
+    uint64_t ncribs[RANK_KING + 1][RANK_KING + 1][2];
+} worker_t;
+
+static void *run_worker(void *arg) {
+    worker_t *worker = arg;
+    deck_t *deck = new_deck();
+    hand_t *mine = new_hand(DEAL_HAND_CARDS);
+    hand_t *theirs = new_hand(DEAL_HAND_CARDS);
+    hand_t *discards = new_hand(2);
+    hand_t *crib = new_hand(5);
+    deal_t deals[BATCH];
+    rng_t rng;
+
+    memset(worker->points, 0, sizeof(worker->points));
+    memset(worker->ncribs, 0, sizeof(worker->ncribs));
+
+    for (uint64_t b = worker->id; b < worker->nbatches; b += worker->nworkers) {
+        rng_init(&rng, worker->seed, worker->first_stream + b);
+        deal_batch(deck, &rng, BATCH, deals);
+
+        for (int d = 0; d < BATCH; d++) {
+            hand_truncate(mine);
+            hand_truncate(theirs);
+            hand_truncate(discards);
+            for (int i = 0; i < DEAL_HAND_CARDS; i++) {
+                hand_append(mine, deals[d].cards[i]);
+                hand_append(theirs, deals[d].cards[DEAL_HAND_CARDS + i]);
+            }
+            sort_cards(theirs->ncards, theirs->cards);
+            discard_ctx_t ctx = {dealer: !worker->dealer, rng: &rng};
+            discard_crib(theirs, discards, &ctx);
+
+            for (int i = 0; i < DEAL_HAND_CARDS; i++) {
+                for (int j = i + 1; j < DEAL_HAND_CARDS; j++) {
+                    card_t card1 = mine->cards[i];
+                    card_t card2 = mine->cards[j];
+                    hand_truncate(crib);
+                    hand_append(crib, card1);
+                    hand_append(crib, card2);
+                    hand_append(crib, discards->cards[0]);
+                    hand_append(crib, discards->cards[1]);
+                    append_starter(crib, deals[d].cards[DEAL_STARTER]);
+
+                    int rank1 = card1.rank < card2.rank ? card1.rank : card2.rank;
+                    int rank2 = card1.rank < card2.rank ? card2.rank : card1.rank;
+                    bool suited = rank1 != rank2 && card1.suit == card2.suit;
+                    worker->points[rank1][rank2][suited] += score_hand(crib).total;
+                    worker->ncribs[rank1][rank2][suited]++;
+                }
+            }
+        }
+    }
+
+    alloc_free(crib);
+    alloc_free(discards);
+    alloc_free(theirs);
+    alloc_free(mine);
+    alloc_free(deck);
+    return NULL;
+}
+
+/* Run one pass of the simulation for one role, and store the results in
+ * table->value[dealer].
+ */
+static void run_pass(crib_table_t *table,
+                     int nthreads,
+                     uint64_t seed,
+                     uint64_t first_stream,
+                     uint64_t nbatches,
+                     bool dealer) {
+    worker_t *workers = calloc(nthreads, sizeof(worker_t));
+    for (int i = 0; i < nthreads; i++) {
+        workers[i].id = i;
+        workers[i].nworkers = nthreads;
+        workers[i].seed = seed;
+        workers[i].first_stream = first_stream;
+        workers[i].nbatches = nbatches;
+        workers[i].dealer = dealer;
+        if (pthread_create(&workers[i].thread, NULL, run_worker, &workers[i]) != 0) {
+            log_fatal("pthread_create() failed for worker %d", i);
+            exit(1);
+        }
+    }
+
+    uint64_t points[RANK_KING + 1][RANK_KING + 1][2] = {{{0}}};
+    uint64_t ncribs[RANK_KING + 1][RANK_KING + 1][2] = {{{0}}};
+    for (int i = 0; i < nthreads; i++) {
+        pthread_join(workers[i].thread, NULL);
+        for (int r1 = RANK_ACE; r1 <= RANK_KING; r1++) {
+            for (int r2 = r1; r2 <= RANK_KING; r2++) {
+                for (int s = 0; s < 2; s++) {
+                    points[r1][r2][s] += workers[i].points[r1][r2][s];
+                    ncribs[r1][r2][s] += workers[i].ncribs[r1][r2][s];
+                }
+            }
+        }
+    }
+    free(workers);
+
+    for (int r1 = RANK_ACE; r1 <= RANK_KING; r1++) {
+        for (int r2 = r1; r2 <= RANK_KING; r2++) {
+            for (int s = 0; s < 2; s++) {
+                // Pairs are never suited: give them the unsuited value.
+                int src = (r1 == r2) ? 0 : s;
+                float value = 0;
+                if (ncribs[r1][r2][src] > 0) {
+                    value = (double) points[r1][r2][src] / ncribs[r1][r2][src];
+                }
+                table->value[dealer][r1][r2][s] = value;
+                table->value[dealer][r2][r1][s] = value;
+            }
+        }
+    }
+}
+
+static void usage(char *prog) {
+    fprintf(stderr,
+            "usage: %s [-v] [-n ndeals] [-i passes] [-j nthreads] [-s seed] -o file\n",
+            prog);
+    exit(2);
+}
+
+int main(int argc, char *argv[]) {
+    int log_level = LOG_INFO;
+    uint64_t ndeals = 1000000;
+    int npasses = 2;
+    int nthreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    uint64_t seed = 1;
+    char *output = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "vn:i:j:s:o:")) != -1) {
+        switch (opt) {
+        case 'v':
+            if (log_level > LOG_TRACE) {
+                log_level--;
+            }
+            break;
+        case 'n':
+            ndeals = strtoull(optarg, NULL, 0);
+            break;
+        case 'i':
+            npasses = atoi(optarg);
+            break;
+        case 'j':
+            nthreads = atoi(optarg);
+            break;
+        case 's':
+            seed = strtoull(optarg, NULL, 0);
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind < argc || output == NULL || npasses < 1 || ndeals < BATCH) {
+        usage(argv[0]);
+    }
+    if (nthreads < 1) {
+        nthreads = 1;
+    }
+    logging_set_level(log_level);
+
+    uint64_t nbatches = ndeals / BATCH;
+    crib_table_t *tables[2] = {
+        calloc(1, sizeof(crib_table_t)),
+        calloc(1, sizeof(crib_table_t)),
+    };
+    for (int pass = 0; pass < npasses; pass++) {
+        // The opponent discards according to the previous pass.
+        crib_table_t *table = tables[pass % 2];
+        crib_table_use(pass == 0 ? NULL : tables[(pass + 1) % 2]);
+        for (int dealer = 0; dealer < 2; dealer++) {
+            uint64_t first_stream = (uint64_t) (pass * 2 + dealer) * nbatches;
+            run_pass(table, nthreads, seed, first_stream, nbatches, dealer);
+        }
+        log_info("pass %d: A-5 crib value: dealer %.3f, pone %.3f",
+                 pass,
+                 table->value[1][RANK_ACE][RANK_5][0],
+                 table->value[0][RANK_ACE][RANK_5][0]);
+    }
+
+    crib_table_t *table = tables[(npasses - 1) % 2];
+    memcpy(table->magic, CRIB_TABLE_MAGIC, sizeof(table->magic));
+    table->version = CRIB_TABLE_VERSION;
+    table->iterations = npasses;
+    table->ndeals = nbatches * BATCH;
+    if (!crib_table_write(output, table)) {
+        exit(1);
+    }
+    log_info("wrote %s: %d passes of %" PRIu64 " deals",
+             output,
+             npasses,
+             table->ndeals);
+
+    free(tables[0]);
+    free(tables[1]);
+    return 0;
+}
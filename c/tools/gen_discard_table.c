@@ -0,0 +1,155 @@
+#define _POSIX_C_SOURCE 200809L    // for getopt(), pthreads
+
+/* Generate a discard table (see discard_table.h): the value of every
+ * discard option of every suit-canonical 6-card hand, as dealer and as
+ * pone.
+ *
+ * Workers enumerate all 6-card hands, but only fill in the ones that are
+ * their own canonical form, so every class is computed exactly once. The
+ * hands are split into units by their two lowest cards, and workers take
+ * units from a shared counter as they go.
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../canon.h"
+#include "../cards.h"
+#include "../crib.h"
+#include "../discard_table.h"
+#include "../handmask.h"
+#include "../logging.h"
+
+#define NUNITS (52 * 51 / 2)
+
+typedef struct {
+    pthread_t thread;
+    discard_table_t *table;
+    int *next_unit;             // shared by all workers
+    uint32_t nclasses;          // filled in by this worker
+} worker_t;
+
+static void *run_worker(void *arg) {
+    worker_t *worker = arg;
+    card_t none = {suit: SUIT_NONE, rank: RANK_JOKER};
+
+    while (true) {
+        int unit = __atomic_fetch_add(worker->next_unit, 1, __ATOMIC_RELAXED);
+        if (unit >= NUNITS) {
+            break;
+        }
+
+        // Unit number -> the two lowest cards.
+        int c0 = 0;
+        while (unit >= 51 - c0) {
+            unit -= 51 - c0;
+            c0++;
+        }
+        int c1 = c0 + 1 + unit;
+
+        handmask_t mask01 = card_mask(card_from_index(c0)) | card_mask(card_from_index(c1));
+        for (int c2 = c1 + 1; c2 < 52; c2++) {
+            handmask_t mask2 = mask01 | card_mask(card_from_index(c2));
+            for (int c3 = c2 + 1; c3 < 52; c3++) {
+                handmask_t mask3 = mask2 | card_mask(card_from_index(c3));
+                for (int c4 = c3 + 1; c4 < 52; c4++) {
+                    handmask_t mask4 = mask3 | card_mask(card_from_index(c4));
+                    for (int c5 = c4 + 1; c5 < 52; c5++) {
+                        handmask_t mask = mask4 | card_mask(card_from_index(c5));
+                        canon_t canon;
+                        canon_mask(&canon, mask, none);
+                        if (canon.hand == mask) {
+                            discard_table_fill(worker->table, mask);
+                            worker->nclasses++;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return NULL;
+}
+
+static void usage(char *prog) {
+    fprintf(stderr, "usage: %s [-v] [-j nthreads] [-c crib-table] -o file\n", prog);
+    exit(2);
+}
+
+int main(int argc, char *argv[]) {
+    int log_level = LOG_INFO;
+    int nthreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    const crib_table_t *crib_table = NULL;
+    char *output = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "vj:c:o:")) != -1) {
+        switch (opt) {
+        case 'v':
+            if (log_level > LOG_TRACE) {
+                log_level--;
+            }
+            break;
+        case 'j':
+            nthreads = atoi(optarg);
+            break;
+        case 'c':
+            crib_table = crib_table_load(optarg);
+            if (crib_table == NULL) {
+                exit(1);
+            }
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind < argc || output == NULL) {
+        usage(argv[0]);
+    }
+    if (nthreads < 1) {
+        nthreads = 1;
+    }
+    logging_set_level(log_level);
+    crib_table_use(crib_table);
+
+    discard_table_t *table = new_discard_table(crib_table != NULL);
+    int next_unit = 0;
+    worker_t workers[nthreads];
+    for (int i = 0; i < nthreads; i++) {
+        workers[i] = (worker_t) {
+            table: table,
+            next_unit: &next_unit,
+            nclasses: 0,
+        };
+        if (pthread_create(&workers[i].thread, NULL, run_worker, &workers[i]) != 0) {
+            log_fatal("pthread_create() failed for worker %d", i);
+            exit(1);
+        }
+    }
+
+    uint32_t nclasses = 0;
+    for (int i = 0; i < nthreads; i++) {
+        pthread_join(workers[i].thread, NULL);
+        nclasses += workers[i].nclasses;
+    }
+    if (nclasses != table->header->nclasses) {
+        log_fatal("filled %u classes, expected %u", nclasses, table->header->nclasses);
+        exit(1);
+    }
+
+    if (!discard_table_write(output, table)) {
+        exit(1);
+    }
+    log_info("wrote %s: %u hands, %s crib values",
+             output,
+             nclasses,
+             crib_table != NULL ? "with" : "without");
+
+    discard_table_free(table);
+    return 0;
+}
@@ -0,0 +1,151 @@
+#define _POSIX_C_SOURCE 200809L    // for getopt(), clock_gettime()
+
+/* Solve the pegging of random deals with perfect information (see
+ * peg_solver.h): deal six cards to each player, let both discard with
+ * the given strategy, and find the best point differential for pone
+ * against dealer with the cards they keep, and the line of play that
+ * achieves it.
+ *
+ * With -p, prints one line per deal:
+ *
+ *   pone 2♣ 5♦ 9♥ K♠  dealer 4♣ 6♦ 6♥ Q♠  value -2:  K♠ 6♦ 5♦ 4♣ 9♥ go ...
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../alloc.h"
+#include "../cards.h"
+#include "../logging.h"
+#include "../peg_solver.h"
+#include "../play.h"
+#include "../rng.h"
+
+#define BATCH 64
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void print_solution(hand_t *hands[], peg_solution_t *solution) {
+    char buf[5 * HAND_MAX_CARDS];
+    printf("pone %s  ", hand_str(buf, sizeof(buf), hands[0]));
+    printf("dealer %s  ", hand_str(buf, sizeof(buf), hands[1]));
+    printf("value %+d: ", solution->value);
+    for (int m = 0; m < solution->nmoves; m++) {
+        card_t card = solution->moves[m].card;
+        printf(" %s", card.rank == RANK_JOKER ? "go" : card_str(buf, card));
+    }
+    printf("\n");
+}
+
+static void usage(char *prog) {
+    fprintf(stderr, "usage: %s [-v] [-p] [-n ndeals] [-s seed] [-d discard]\n", prog);
+    fprintf(stderr, "discard strategies: simple, random, expected, crib\n");
+    exit(2);
+}
+
+int main(int argc, char *argv[]) {
+    int log_level = LOG_INFO;
+    long ndeals = 1000;
+    uint64_t seed = 42;
+    discard_func_t discard = discard_simple;
+    bool print = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "vpn:s:d:")) != -1) {
+        switch (opt) {
+        case 'v':
+            if (log_level > LOG_TRACE) {
+                log_level--;
+            }
+            break;
+        case 'p':
+            print = true;
+            break;
+        case 'n':
+            ndeals = atol(optarg);
+            break;
+        case 's':
+            seed = strtoull(optarg, NULL, 0);
+            break;
+        case 'd':
+            discard = discard_func_by_name(optarg);
+            if (discard == NULL) {
+                fprintf(stderr, "unknown discard strategy: %s\n", optarg);
+                usage(argv[0]);
+            }
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind < argc) {
+        usage(argv[0]);
+    }
+    logging_set_level(log_level);
+
+    deck_t *deck = new_deck();
+    peg_solver_t *solver = new_peg_solver(16);
+    deal_t deals[BATCH];
+    rng_t rng;
+    rng_init(&rng, seed, 0);
+
+    long total_value = 0;
+    long histogram[2 * 32 + 1] = {0};
+    double solve_ns = 0;
+    for (long d = 0; d < ndeals; d++) {
+        if (d % BATCH == 0) {
+            deal_batch(deck, &rng, BATCH, deals);
+        }
+
+        // Player 0 is pone, player 1 is dealer.
+        hand_t hand_0, hand_1, crib;
+        hand_t *hands[2] = {&hand_0, &hand_1};
+        hand_init(&crib, 4);
+        for (int p = 0; p < 2; p++) {
+            hand_init(hands[p], DEAL_HAND_CARDS);
+            for (int i = 0; i < DEAL_HAND_CARDS; i++) {
+                hand_append(hands[p], deals[d % BATCH].cards[p * DEAL_HAND_CARDS + i]);
+            }
+            sort_cards(hands[p]->ncards, hands[p]->cards);
+            discard_ctx_t ctx = {dealer: p == 1, rng: &rng, data: NULL};
+            discard(hands[p], &crib, &ctx);
+        }
+
+        peg_solution_t solution;
+        double start = now_ns();
+        int value = peg_solve_hands(solver, hands, &solution);
+        solve_ns += now_ns() - start;
+
+        total_value += value;
+        if (value >= -32 && value <= 32) {
+            histogram[value + 32]++;
+        }
+        if (print) {
+            print_solution(hands, &solution);
+        }
+    }
+
+    log_info("%ld deals: pone - dealer = %.3f points on average",
+             ndeals,
+             (double) total_value / ndeals);
+    for (int v = 0; v < 2 * 32 + 1; v++) {
+        if (histogram[v] > 0) {
+            log_debug("  value %+3d: %ld deals", v - 32, histogram[v]);
+        }
+    }
+    log_info("%.1f positions, %.2f us per solve",
+             (double) solver->nodes / ndeals,
+             solve_ns / ndeals / 1000);
+
+    peg_solver_free(solver);
+    alloc_free(deck);
+    return 0;
+}